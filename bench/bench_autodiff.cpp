@@ -0,0 +1,539 @@
+#include <benchmark/benchmark.h>
+#include <autodiff/autodiff.hpp>
+#include <malloc.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+using namespace autodiff;
+
+// Counts every global allocation so heap and arena graphs can be compared.
+// GCC cannot see that these replacements pair malloc with free.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static std::atomic<size_t> g_heapAllocations{0};
+static std::atomic<size_t> g_heapBytes{0};
+// Bytes currently held, as malloc reports the block sizes.
+static std::atomic<size_t> g_liveBytes{0};
+
+void *operator new(size_t bytes) {
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_heapBytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (void *p = std::malloc(bytes ? bytes : 1)) {
+        g_liveBytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    if (p) g_liveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    std::free(p);
+}
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+static benchmark::Counter perNode(double nodes) {
+    return benchmark::Counter(nodes, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+static std::vector<Node *> rootsOf(const std::vector<std::shared_ptr<Node>> &outputs) {
+    std::vector<Node *> roots;
+    roots.reserve(outputs.size());
+    for (const auto &o : outputs) roots.push_back(o.get());
+    return roots;
+}
+
+// Four nodes per leaf: sin, mul, add, exp.
+static void buildAndDifferentiate(const std::vector<std::shared_ptr<Node>> &leaves, bool differentiate) {
+    std::vector<std::shared_ptr<Node>> outputs;
+    outputs.reserve(leaves.size());
+    for (const auto &leaf : leaves) {
+        outputs.push_back(exp(sin(leaf) * leaf + 1.0));
+    }
+    if (differentiate) {
+        std::vector<Node *> roots = rootsOf(outputs);
+        Tape tape(roots);
+        tape.backward(std::vector<double>(roots.size(), 1.0));
+    }
+    benchmark::DoNotOptimize(outputs.data());
+}
+
+static void BM_Graph(benchmark::State &state) {
+    const bool useArena = state.range(0) != 0;
+    const bool differentiate = state.range(1) != 0;
+    const size_t nleaves = 200000;
+    std::vector<std::shared_ptr<Node>> leaves;
+    for (size_t i=0; i < nleaves; i++) {
+        leaves.push_back(std::make_shared<IndVarNode>(0.001 * i));
+    }
+
+    size_t allocations = 0;
+    for (auto _ : state) {
+        size_t before = g_heapAllocations.load();
+        if (useArena) {
+            GraphArena arena(16 << 20);
+            buildAndDifferentiate(leaves, differentiate);
+        } else {
+            buildAndDifferentiate(leaves, differentiate);
+        }
+        allocations += g_heapAllocations.load() - before;
+    }
+
+    const double nodes = 4.0 * nleaves;
+    state.counters["heap_allocs/iter"] = benchmark::Counter(
+        static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+    state.counters["time/node"] = perNode(nodes);
+}
+BENCHMARK(BM_Graph)
+    ->ArgNames({"arena", "backward"})
+    ->Args({0, 0})->Args({1, 0})->Args({0, 1})->Args({1, 1})
+    ->Unit(benchmark::kMillisecond);
+
+template <class V>
+static void BM_Elementwise(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(0));
+    std::vector<double> xs(n);
+    for (size_t i=0; i < n; i++) xs[i] = 1.0 + 0.001 * i;
+    V a(xs), b(xs), c(xs);
+    for (auto _ : state) {
+        V o = (a * b + c.sin()).exp().log();
+        o.backward();
+        benchmark::DoNotOptimize(o.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_Elementwise, Vector)->RangeMultiplier(16)->Range(1 << 10, 1 << 18)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_Elementwise, Tensor)->RangeMultiplier(16)->Range(1 << 10, 1 << 18)->Unit(benchmark::kMicrosecond);
+
+// One elementwise product and its backward pass, from 10^3 elements up. A
+// Vector holds a node graph per element, around 500 bytes each, so it stops
+// at 10^6; the contiguous Tensor goes on to 10^7.
+template <class V>
+static void BM_VectorOp(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(0));
+    std::vector<double> xs(n, 1.5);
+    V a(xs), b(xs);
+    for (auto _ : state) {
+        V o = a * b;
+        o.backward();
+        benchmark::DoNotOptimize(o.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_VectorOp, Vector)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_VectorOp, Tensor)->RangeMultiplier(10)->Range(1000, 10000000)->Unit(benchmark::kMillisecond);
+
+// A chain of Vector temporaries built and swept, with the heap it leaves
+// behind once everything has gone out of scope.
+static void BM_VectorChain(benchmark::State &state) {
+    const size_t n = 1 << 14;
+    std::vector<double> xs(n, 0.5);
+    size_t kept = 0;
+    for (auto _ : state) {
+        size_t before = g_liveBytes.load();
+        {
+            Vector a(xs), b(xs), c(xs);
+            Vector o = (a * b + c.sin()).exp().log();
+            o.backward();
+            benchmark::DoNotOptimize(o.size());
+        }
+        kept += g_liveBytes.load() - before;
+    }
+    state.counters["kept bytes"] = benchmark::Counter(static_cast<double>(kept), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_VectorChain)->Unit(benchmark::kMicrosecond);
+
+// Cost of creating (and releasing) one node of each kind, and the heap bytes
+// it takes.
+static std::shared_ptr<Node> construct(int op, const std::shared_ptr<Node> &x, const std::shared_ptr<Node> &y) {
+    switch (op) {
+    case 0: return x + y;
+    case 1: return x - y;
+    case 2: return x * y;
+    case 3: return x / y;
+    case 4: return -x;
+    case 5: return sin(x);
+    case 6: return cos(x);
+    case 7: return tan(x);
+    case 8: return exp(x);
+    case 9: return log(x);
+    case 10: return sqrt(x);
+    default: return abs(x);
+    }
+}
+
+static void BM_Construct(benchmark::State &state) {
+    static const char *names[] = {
+        "add", "sub", "mul", "div", "neg", "sin", "cos", "tan", "exp", "log", "sqrt", "abs"
+    };
+    const int op = static_cast<int>(state.range(0));
+    const size_t n = 1 << 14;
+    std::shared_ptr<Node> x = std::make_shared<IndVarNode>(0.7), y = std::make_shared<IndVarNode>(1.3);
+    std::vector<std::shared_ptr<Node>> nodes(n);
+
+    size_t bytes = 0;
+    for (auto _ : state) {
+        size_t before = g_heapBytes.load();
+        for (size_t i=0; i < n; i++) nodes[i] = construct(op, x, y);
+        bytes += g_heapBytes.load() - before;
+        benchmark::DoNotOptimize(nodes.data());
+    }
+    state.SetLabel(names[op]);
+    state.counters["time/node"] = perNode(static_cast<double>(n));
+    state.counters["bytes/node"] = benchmark::Counter(
+        static_cast<double>(bytes) / n, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_Construct)->DenseRange(0, 11);
+
+// Tape recording and sweep over one chain of sin nodes. The depth stays well
+// below what recursive node destruction can handle on a default stack.
+static void BM_DeepChain(benchmark::State &state) {
+    const size_t depth = static_cast<size_t>(state.range(0));
+    auto leaf = std::make_shared<IndVarNode>(0.5);
+    std::shared_ptr<Node> y = leaf;
+    for (size_t i=0; i < depth; i++) y = sin(y);
+
+    for (auto _ : state) {
+        Tape tape({ y.get() });
+        tape.backward({ 1.0 });
+    }
+    state.counters["time/node"] = perNode(static_cast<double>(depth + 1));
+}
+BENCHMARK(BM_DeepChain)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMicrosecond);
+
+// Tape recording and sweep for sum_i x_i * w: a pairwise sum of n products
+// into one root, where every product also feeds adjoints into the shared w.
+static void BM_WideFanIn(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(0));
+    auto w = std::make_shared<IndVarNode>(0.5);
+    std::vector<std::shared_ptr<Node>> level;
+    for (size_t i=0; i < n; i++) level.push_back(std::make_shared<IndVarNode>(0.001 * i) * w);
+    while (level.size() > 1) {
+        std::vector<std::shared_ptr<Node>> next;
+        for (size_t i=0; i + 1 < level.size(); i += 2) next.push_back(level[i] + level[i + 1]);
+        if (level.size() % 2) next.push_back(level.back());
+        level.swap(next);
+    }
+
+    size_t nodes = 0;
+    for (auto _ : state) {
+        Tape tape({ level[0].get() });
+        tape.backward({ 1.0 });
+        nodes = tape.size();
+    }
+    state.counters["time/node"] = perNode(static_cast<double>(nodes));
+}
+BENCHMARK(BM_WideFanIn)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+
+// Builds a * b + sin(c) * exp(a) - b / c, with the leaves optionally wrapped for fusion.
+static void BM_Formula(benchmark::State &state) {
+    const bool fused = state.range(0) != 0;
+    auto a = std::make_shared<IndVarNode>(0.4);
+    auto b = std::make_shared<IndVarNode>(2.5);
+    auto c = std::make_shared<IndVarNode>(1.1);
+    std::shared_ptr<Node> na = a, nb = b, nc = c;
+    auto formula = [](const auto &x, const auto &y, const auto &z) {
+        return x * y + sin(z) * exp(x) - y / z;
+    };
+    for (auto _ : state) {
+        std::shared_ptr<Node> o = fused ? formula(expr::ref(na), expr::ref(nb), expr::ref(nc)) : formula(na, nb, nc);
+        benchmark::DoNotOptimize(o->value);
+    }
+}
+BENCHMARK(BM_Formula)->ArgName("fused")->Arg(0)->Arg(1);
+
+// Backward sweep alone over sin, cos, tan, exp and sqrt of every leaf.
+static void BM_TranscendentalBackward(benchmark::State &state) {
+    const size_t nleaves = 100000;
+    std::vector<std::shared_ptr<Node>> leaves, outputs;
+    for (size_t i=0; i < nleaves; i++) {
+        leaves.push_back(std::make_shared<IndVarNode>(0.5 + 0.00001 * i));
+        outputs.push_back(sqrt(exp(tan(sin(leaves[i]) * cos(leaves[i])))));
+    }
+    Tape tape(rootsOf(outputs));
+    const std::vector<double> seeds(outputs.size(), 1.0);
+
+    for (auto _ : state) {
+        tape.propagate(seeds);
+        benchmark::DoNotOptimize(tape.adjoint(0));
+    }
+    state.counters["time/node"] = perNode(static_cast<double>(tape.size()));
+}
+BENCHMARK(BM_TranscendentalBackward)->Unit(benchmark::kMillisecond);
+
+// Forward and backward of one formula over 64 elements, either rebuilding the
+// Vector graph every time or replaying it compiled.
+static void BM_Replay(benchmark::State &state) {
+    const bool compiled = state.range(0) != 0;
+    const size_t n = 64;
+    std::vector<double> xs(n, 0.5);
+    auto formula = [](Vector &a, Vector &b) { return a.sin() + b.cos() + a * 5 - (b + 2); };
+    Vector a(xs), b(xs);
+    CompiledFunction f({ &a, &b }, formula(a, b));
+    std::vector<double> x(2 * n, 0.7), y(n), seeds(n, 1.0), grad(2 * n);
+
+    for (auto _ : state) {
+        if (compiled) {
+            f.forward(x.data(), y.data());
+            f.backward(seeds.data(), grad.data());
+        } else {
+            Vector c(x.data(), n), d(x.data() + n, n);
+            Vector o = formula(c, d);
+            o.backward();
+            o.values(y.data());
+        }
+        benchmark::DoNotOptimize(y.data());
+    }
+}
+BENCHMARK(BM_Replay)->ArgName("compiled")->Arg(0)->Arg(1);
+
+// The same step on a retained graph: set leaves, forward, zero grad, backward.
+static void BM_Retained(benchmark::State &state) {
+    const size_t n = 64;
+    std::vector<double> xs(n, 0.5), ys(n);
+    Vector a(xs), b(xs);
+    Vector o = a.sin() + b.cos() + a * 5 - (b + 2);
+    o.retain();
+    for (auto _ : state) {
+        a.set_values(xs);
+        o.forward();
+        a.zero_grad();
+        b.zero_grad();
+        o.backward();
+        o.values(ys.data());
+        benchmark::DoNotOptimize(ys.data());
+    }
+}
+BENCHMARK(BM_Retained);
+
+// Full 64 x 64 Jacobian of a coupled map, sweeping `lanes` rows at a time.
+static void BM_Jacobian(benchmark::State &state) {
+    const size_t n = 64;
+    std::vector<double> xs(n, 0.5);
+    Vector a(xs);
+    Vector o(n);
+    for (size_t i=0; i < n; i++) o[i] = sin(a[i]) * a[(i + 1) % n] + a[(i + 7) % n];
+    for (auto _ : state) {
+        std::vector<double> jac = jacobian(o, a, static_cast<size_t>(state.range(0)));
+        benchmark::DoNotOptimize(jac.data());
+    }
+}
+BENCHMARK(BM_Jacobian)->ArgName("lanes")->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// Dense against colored extraction of a Jacobian with three entries per row.
+static void BM_SparseJacobian(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(1));
+    std::vector<double> xs(n, 0.5);
+    Vector a(xs);
+    Vector o(n);
+    for (size_t i=0; i < n; i++) o[i] = sin(a[i]) * a[(i + 1) % n] + a[(i + 7) % n];
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            std::vector<double> jac = jacobian(o, a);
+            benchmark::DoNotOptimize(jac.data());
+        } else {
+            SparseMatrix jac = sparse_jacobian(o, a);
+            benchmark::DoNotOptimize(jac.values.data());
+        }
+    }
+}
+BENCHMARK(BM_SparseJacobian)->ArgNames({ "sparse", "n" })->ArgsProduct({ { 0, 1 }, { 64, 1024 } })
+    ->Unit(benchmark::kMicrosecond);
+
+// Build and backward of the same Vector formula on the virtual-dispatch nodes
+// and on the flat record engine, whose ops are rewound after each step.
+template <class V>
+static void stepFormula(V &a, V &b) {
+    V o = (a.sin() * b + 1.0).exp() / (b - a.cos());
+    o.backward();
+    benchmark::DoNotOptimize(o.size());
+}
+
+static void BM_Dispatch(benchmark::State &state) {
+    const size_t n = 1 << 14;
+    std::vector<double> xs(n, 0.5);
+    if (state.range(0) == 0) {
+        Vector a(xs), b(xs);
+        for (auto _ : state) stepFormula(a, b);
+    } else {
+        flat::Graph graph;
+        flat::Vector a(xs), b(xs);
+        const size_t leaves = graph.size();
+        for (auto _ : state) {
+            stepFormula(a, b);
+            graph.rewind(leaves);
+        }
+    }
+    state.counters["time/node"] = perNode(6.0 * n);
+}
+BENCHMARK(BM_Dispatch)->ArgName("flat")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// The same formula on the flat engine in double, float and float values
+// with double gradients. The backward loop streams the records, so its cost
+// follows the record size: 40 bytes in double, 24 in the other two.
+template <class V>
+static void flatPrecision(benchmark::State &state) {
+    const size_t n = 1 << 16;
+    typename V::Graph graph;
+    std::vector<typename V::Graph::value_type> xs(n, 0.5f);
+    V a(xs), b(xs);
+    const size_t leaves = graph.size();
+    for (auto _ : state) {
+        stepFormula(a, b);
+        graph.rewind(leaves);
+    }
+    state.counters["time/node"] = perNode(6.0 * n);
+}
+
+static void BM_FlatPrecision(benchmark::State &state) {
+    switch (state.range(0)) {
+    case 0: flatPrecision<flat::Vector>(state); break;
+    case 1: flatPrecision<flat::Vector32>(state); break;
+    default: flatPrecision<flat::MixedVector>(state); break;
+    }
+}
+BENCHMARK(BM_FlatPrecision)->ArgName("dtype")->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMicrosecond);
+
+// One Hessian-vector product against one gradient sweep, both on a tape
+// recorded up front, for sum_i exp(sin(x_i) * x_{i+1}) / x_i.
+static void BM_HessianVector(benchmark::State &state) {
+    const size_t n = 1000;
+    std::vector<double> xs(n, 0.5), v(n, 1.0), hv(n);
+    Vector x(xs);
+    Vector o(n);
+    for (size_t i=0; i < n; i++) o[i] = exp(sin(x[i]) * x[(i + 1) % n]) / x[i];
+    if (state.range(0) == 0) {
+        Tape tape(o.roots());
+        for (auto _ : state) tape.propagate(std::vector<double>(n, 1.0));
+    } else {
+        HessianTape tape(o.roots(), x.roots(), std::vector<double>(n, 1.0));
+        for (auto _ : state) tape.product(v.data(), hv.data());
+    }
+}
+BENCHMARK(BM_HessianVector)->ArgName("hvp")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// Build and backward of a 256-step simulation, kept whole or checkpointed
+// with the given budget of live step results (0: sqrt schedule).
+static void BM_Checkpoint(benchmark::State &state) {
+    const size_t n = 64, steps = 256;
+    std::vector<double> xs(n, 0.5);
+    Segment step = [](Vector &x) { return x.sin() * 0.9 + x * 0.1; };
+    for (auto _ : state) {
+        Vector x(xs);
+        Vector y = x;
+        if (state.range(0) < 0) {
+            for (size_t i=0; i < steps; i++) y = step(y);
+        } else {
+            y = checkpoint_steps(step, x, steps, static_cast<size_t>(state.range(0)));
+        }
+        y.backward();
+        benchmark::DoNotOptimize(y.size());
+    }
+}
+BENCHMARK(BM_Checkpoint)->ArgName("budget")->Arg(-1)->Arg(0)->Arg(8)->Unit(benchmark::kMillisecond);
+
+// Build and backward of a sum, folded through operator+ or as one node.
+static void BM_Reduction(benchmark::State &state) {
+    const size_t n = 100000;
+    std::vector<double> xs(n, 0.5);
+    Vector a(xs);
+    for (auto _ : state) {
+        Variable s = 0.0;
+        if (state.range(0) == 0) {
+            for (size_t i=0; i < n; i++) s = s + a[i];
+        } else {
+            s = a.sum();
+        }
+        s.VarNodePtr->prop(1.0);
+        benchmark::DoNotOptimize(s.values());
+    }
+}
+BENCHMARK(BM_Reduction)->ArgName("node")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// Square GEMM: the blocked kernel on one thread and on the pool, against
+// the textbook i-p-j loop.
+static void BM_Gemm(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(1));
+    std::vector<double> a(n * n, 0.5), b(n * n, 0.25), c(n * n);
+    ThreadPool single(1);
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            for (size_t i=0; i < n; i++) {
+                for (size_t p=0; p < n; p++) {
+                    for (size_t j=0; j < n; j++) c[i * n + j] += a[i * n + p] * b[p * n + j];
+                }
+            }
+        } else {
+            kernels::gemm(false, false, n, n, n, a.data(), b.data(), c.data(),
+                          state.range(0) == 1 ? single : ThreadPool::instance());
+        }
+        benchmark::DoNotOptimize(c.data());
+    }
+    state.counters["flops"] = benchmark::Counter(2.0 * n * n * n, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_Gemm)->ArgNames({ "kernel", "n" })->ArgsProduct({ { 0, 1, 2 }, { 256, 1024 } })
+    ->Unit(benchmark::kMillisecond);
+
+// A linear layer's forward and backward: tanh-free y = W x batch, then sum.
+static void BM_MatmulBackward(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(0));
+    std::vector<double> xs(n * n, 0.5);
+    Matrix w(xs, n, n), x(xs, n, n);
+    for (auto _ : state) {
+        Matrix y = matmul(w, x);
+        y.backward();
+        benchmark::DoNotOptimize(y.size());
+    }
+}
+BENCHMARK(BM_MatmulBackward)->Arg(256)->Arg(512)->Unit(benchmark::kMillisecond);
+
+// Throughput of the vmath kernels over 4096 values, per function (sin, exp,
+// log, sqrt) and instruction set, against a libm loop (isa 0). Instruction
+// sets the CPU lacks are skipped.
+static void BM_VectorMath(benchmark::State &state) {
+    const size_t n = 4096;
+    const int isa = static_cast<int>(state.range(1));
+    std::vector<double> x(n), y(n);
+    for (size_t i=0; i < n; i++) x[i] = 0.1 + 0.001 * i;
+    if (isa > static_cast<int>(vmath::detect()) + 1) {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    typedef void (*Kernel)(size_t, const double *, double *);
+    typedef double (*Reference)(double);
+    const Kernel kernels[] = { vmath::sin, vmath::exp, vmath::log, vmath::sqrt };
+    const Reference libm[] = { [](double v) { return std::sin(v); }, [](double v) { return std::exp(v); },
+                               [](double v) { return std::log(v); }, [](double v) { return std::sqrt(v); } };
+    const Kernel f = kernels[state.range(0)];
+    const Reference g = libm[state.range(0)];
+    const vmath::Isa saved = vmath::isa();
+    if (isa > 0) vmath::isa() = static_cast<vmath::Isa>(isa - 1);
+    for (auto _ : state) {
+        if (isa == 0) {
+            for (size_t i=0; i < n; i++) y[i] = g(x[i]);
+        } else {
+            f(n, x.data(), y.data());
+        }
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    vmath::isa() = saved;
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+BENCHMARK(BM_VectorMath)->ArgNames({ "fn", "isa" })->ArgsProduct({ { 0, 1, 2, 3 }, { 0, 1, 2, 3 } });
+
+// Forward and backward of sin over a Tensor, both passes through vmath.
+static void BM_TensorSin(benchmark::State &state) {
+    const size_t n = static_cast<size_t>(state.range(0));
+    std::vector<double> xs(n, 0.5);
+    for (auto _ : state) {
+        Tensor x(xs);
+        Tensor y = x.sin();
+        y.backward();
+        benchmark::DoNotOptimize(y.size());
+    }
+}
+BENCHMARK(BM_TensorSin)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,47 @@
+"""Round-trip cost of the Python bindings.
+
+Times small graphs driven from Python, where call overhead dominates, and
+writes the results as JSON (seconds per call) to the path given as the first
+argument, or stdout.
+"""
+import json
+import sys
+import timeit
+
+import numpy as np
+
+import autodiff
+
+
+def cases(n):
+    x = np.linspace(0.5, 2.0, n)
+    a = autodiff.vec(x)
+    b = autodiff.vec(x)
+    q = a * b
+    t = autodiff.tensor(x)
+    return {
+        'vec_from_numpy': lambda: autodiff.vec(x),
+        'vec_mul': lambda: a * b,
+        'vec_sin': lambda: a.sin(),
+        'vec_backward': q.backward,
+        'vec_grad': a.grad,
+        'vec_getitem': lambda: a[0],
+        'tensor_mul': lambda: t * t,
+        'tensor_values': t.values,
+    }
+
+
+def main():
+    results = []
+    for n in (1, 100, 10000):
+        for name, fn in cases(n).items():
+            number, _ = timeit.Timer(fn).autorange()
+            best = min(timeit.repeat(fn, number=number, repeat=5)) / number
+            results.append({'name': '%s/%d' % (name, n), 'size': n, 'seconds': best})
+
+    out = open(sys.argv[1], 'w') if len(sys.argv) > 1 else sys.stdout
+    json.dump({'benchmarks': results}, out, indent=2)
+
+
+if __name__ == '__main__':
+    main()
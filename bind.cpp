@@ -1,4 +1,5 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/operators.h>
 #include <pybind11/stl.h>
 #include <autodiff/autodiff.hpp>
@@ -6,37 +7,427 @@
 namespace py = pybind11;
 using namespace autodiff;
 
+using DoubleArray = py::array_t<double, py::array::c_style | py::array::forcecast>;
+
+// Graph building and backward passes run without the GIL so other Python
+// threads can work on independent graphs meanwhile. They share the native
+// thread pool, which is created once and resized in place, so that is safe
+// from any thread.
+using nogil = py::call_guard<py::gil_scoped_release>;
+
+// 1-D array viewing `data` without a copy; `owner` is kept alive by the array.
+py::array_t<double> view(double *data, size_t size, py::handle owner, bool writeable) {
+    py::array_t<double> res({ static_cast<py::ssize_t>(size) }, { static_cast<py::ssize_t>(sizeof(double)) },
+                            data, owner);
+    if (!writeable) res.attr("setflags")(py::arg("write") = false);
+    return res;
+}
+
+// Copy of CSR offsets or column indices as a numpy index array.
+py::array_t<int64_t> index_array(const std::vector<size_t> &indices) {
+    py::array_t<int64_t> res(static_cast<py::ssize_t>(indices.size()));
+    std::copy(indices.begin(), indices.end(), res.mutable_data());
+    return res;
+}
+
+// Wraps a Python callable as a checkpoint segment. Backward rebuilds segments
+// with the GIL released, so calls take it back, and the callable is only
+// released under the GIL however the C++ copies are dropped.
+Segment segment(py::function fn) {
+    std::shared_ptr<py::function> f(new py::function(std::move(fn)), [](py::function *p) {
+        py::gil_scoped_acquire gil;
+        delete p;
+    });
+    return [f](Vector &x) {
+        py::gil_scoped_acquire gil;
+        return (*f)(x).cast<Vector>();
+    };
+}
+
+// Row-major rows x cols copy as a 2-D array.
+py::array_t<double> array2d(const std::vector<double> &data, size_t rows, size_t cols) {
+    py::array_t<double> res({ static_cast<py::ssize_t>(rows), static_cast<py::ssize_t>(cols) });
+    std::copy(data.begin(), data.end(), res.mutable_data());
+    return res;
+}
+
+// Name of the flat engine instantiation for a dtype= argument: numpy.float64,
+// numpy.float32, or "mixed" for float values with double gradients.
+std::string precision(py::object dtype) {
+    if (py::isinstance<py::str>(dtype) && dtype.cast<std::string>() == "mixed") return "mixed";
+    py::dtype dt = py::dtype::from_args(dtype);
+    if (dt.kind() == 'f' && dt.itemsize() == 8) return "float64";
+    if (dt.kind() == 'f' && dt.itemsize() == 4) return "float32";
+    throw std::runtime_error("dtype must be float64, float32 or \"mixed\"");
+}
+
+// Scalar results go to Python as 1-element vecs, so backward() and values()
+// work on them as on any other vec.
+Vector scalar(const Variable &v) {
+    Vector res(1);
+    res[0] = v;
+    return res;
+}
+
+// Flat engine of one precision as graph_<name> and flatvec_<name>. A graph
+// makes leaves with vec(); every result keeps its operands, and through them
+// the graph, alive. Unlike vec, these keep the GIL: ops append to the
+// graph's shared record array and backward() walks it, so two threads on
+// one graph would race, and appends are too cheap to gain from releasing it.
+template <class T, class G>
+void bind_flat(py::module &m, const std::string &name) {
+    using Graph = flat::BasicGraph<T, G>;
+    using V = flat::BasicVector<T, G>;
+    using Array = py::array_t<T, py::array::c_style | py::array::forcecast>;
+    using keep_self = py::keep_alive<0, 1>;
+    using keep_other = py::keep_alive<0, 2>;
+
+    py::class_<Graph>(m, ("graph_" + name).c_str())
+        .def(py::init([] { return new Graph(typename Graph::Detached{}); }))
+        .def("__len__", &Graph::size)
+        .def("vec", [](Graph &g, Array a) {
+            if (a.ndim() != 1) throw std::runtime_error("expected a 1-D array");
+            return V(g, a.data(), static_cast<size_t>(a.shape(0)));
+        }, keep_self());
+
+    py::class_<V>(m, ("flatvec_" + name).c_str())
+        .def("__len__", &V::size)
+        .def("__getitem__", &V::getitem)
+        .def("__repr__", &V::info)
+        .def("values", [](const V &v) {
+            py::array_t<T> res(v.size());
+            v.values(res.mutable_data());
+            return res;
+        })
+        .def("grad", [](const V &v) {
+            py::array_t<G> res(v.size());
+            v.grad(res.mutable_data());
+            return res;
+        })
+        .def("backward", static_cast<void (V::*)()>(&V::backward))
+        .def("backward", [](V &v, py::array_t<G, py::array::c_style | py::array::forcecast> seed) {
+            v.backward(std::vector<G>(seed.data(), seed.data() + seed.size()));
+        }, py::arg("seed"))
+        .def("zero_grad", &V::zero_grad)
+        .def("set_values", [](V &v, Array a) {
+            if (static_cast<size_t>(a.size()) != v.size()) throw std::runtime_error("size not same");
+            v.set_values(a.data());
+        })
+        .def("retain", &V::retain, py::arg("on") = true)
+        .def("retained", &V::retained)
+        .def("forward", &V::forward)
+        .def(py::self + py::self, keep_self(), keep_other())
+        .def(T() + py::self, keep_self())
+        .def(py::self + T(), keep_self())
+        .def(py::self - py::self, keep_self(), keep_other())
+        .def(T() - py::self, keep_self())
+        .def(py::self - T(), keep_self())
+        .def(py::self * py::self, keep_self(), keep_other())
+        .def(T() * py::self, keep_self())
+        .def(py::self * T(), keep_self())
+        .def(py::self / py::self, keep_self(), keep_other())
+        .def(T() / py::self, keep_self())
+        .def(py::self / T(), keep_self())
+        .def("sin", &V::sin, keep_self())
+        .def("cos", &V::cos, keep_self())
+        .def("tan", &V::tan, keep_self())
+        .def("exp", &V::exp, keep_self())
+        .def("log", &V::log, keep_self())
+        .def("sqrt", &V::sqrt, keep_self())
+        .def("abs", &V::abs, keep_self());
+}
 
 PYBIND11_MODULE(autodiff, m) {
     py::class_<Vector>(m, "vec")
         .def(py::init<size_t>())
-        .def(py::init<std::vector<double> &>())
+        // vec is the double node engine; other precisions are flat graphs,
+        // which own their records, so dtype= picks one through graph().
+        .def(py::init([](DoubleArray a, py::object dtype) {
+            if (precision(dtype) != "float64") {
+                throw py::type_error("vec is float64; use graph(dtype=...).vec() for float32 or mixed");
+            }
+            if (a.ndim() != 1) throw std::runtime_error("expected a 1-D array");
+            return Vector(a.data(), static_cast<size_t>(a.shape(0)));
+        }), py::arg("values"), py::arg("dtype") = "float64")
         .def("__len__", &Vector::size)
         .def("__getitem__", &Vector::getitem)
         .def("__setitem__", &Vector::setitem)
         .def("__repr__", &Vector::info)
-        .def("grad", &Vector::grad)
-        .def("values", &Vector::values)
-        .def("backward", &Vector::backward)
-        .def(py::self + py::self)
-        .def(double() + py::self)
-        .def(py::self + double())
-        .def(py::self - py::self)
-        .def(double() - py::self)
-        .def(py::self - double())
-        .def(py::self * py::self)
-        .def(double() * py::self)
-        .def(py::self * double())
-        .def(py::self / py::self)
-        .def(double() / py::self)
-        .def(py::self / double())
-        .def("sin", &Vector::sin)
-        .def("cos", &Vector::cos)
-        .def("tan", &Vector::tan)
-        .def("exp", &Vector::exp)
-        .def("log", &Vector::log)
-        .def("sqrt", &Vector::sqrt)
-        .def("abs", &Vector::abs);
+        .def("grad", [](const Vector &v) {
+            py::array_t<double> res(v.size());
+            v.grad(res.mutable_data());
+            return res;
+        })
+        .def("values", [](const Vector &v) {
+            py::array_t<double> res(v.size());
+            v.values(res.mutable_data());
+            return res;
+        })
+        .def("backward", static_cast<void (Vector::*)()>(&Vector::backward), nogil())
+        .def("backward", [](Vector &v, DoubleArray seed) {
+            std::vector<double> s(seed.data(), seed.data() + seed.size());
+            py::gil_scoped_release release;
+            v.backward(s);
+        }, py::arg("seed"))
+        .def("zero_grad", &Vector::zero_grad)
+        .def("set_values", [](Vector &v, DoubleArray a) {
+            if (static_cast<size_t>(a.size()) != v.size()) throw std::runtime_error("size not same");
+            v.set_values(a.data());
+        })
+        .def("retain", &Vector::retain, py::arg("on") = true)
+        .def("retained", &Vector::retained)
+        .def("forward", &Vector::forward, nogil())
+        .def(py::self + py::self, nogil())
+        .def(double() + py::self, nogil())
+        .def(py::self + double(), nogil())
+        .def(py::self - py::self, nogil())
+        .def(double() - py::self, nogil())
+        .def(py::self - double(), nogil())
+        .def(py::self * py::self, nogil())
+        .def(double() * py::self, nogil())
+        .def(py::self * double(), nogil())
+        .def(py::self / py::self, nogil())
+        .def(double() / py::self, nogil())
+        .def(py::self / double(), nogil())
+        .def("sin", &Vector::sin, nogil())
+        .def("cos", &Vector::cos, nogil())
+        .def("tan", &Vector::tan, nogil())
+        .def("exp", &Vector::exp, nogil())
+        .def("log", &Vector::log, nogil())
+        .def("sqrt", &Vector::sqrt, nogil())
+        .def("abs", &Vector::abs, nogil())
+        .def("sum", [](const Vector &v) { return scalar(v.sum()); }, nogil())
+        .def("mean", [](const Vector &v) { return scalar(v.mean()); }, nogil())
+        .def("dot", [](const Vector &v, const Vector &r) { return scalar(v.dot(r)); }, nogil())
+        .def("norm2", [](const Vector &v) { return scalar(v.norm2()); }, nogil())
+        .def(py::self += py::self, nogil())
+        .def(py::self += double(), nogil())
+        .def(py::self -= py::self, nogil())
+        .def(py::self -= double(), nogil())
+        .def(py::self *= py::self, nogil())
+        .def(py::self *= double(), nogil())
+        .def(py::self /= py::self, nogil())
+        .def(py::self /= double(), nogil())
+        .def("sin_", &Vector::sin_, nogil())
+        .def("cos_", &Vector::cos_, nogil())
+        .def("tan_", &Vector::tan_, nogil())
+        .def("exp_", &Vector::exp_, nogil())
+        .def("log_", &Vector::log_, nogil())
+        .def("sqrt_", &Vector::sqrt_, nogil())
+        .def("abs_", &Vector::abs_, nogil());
+
+    // Contiguous storage: values and grad are views, not copies.
+    py::class_<Tensor>(m, "tensor", py::buffer_protocol())
+        .def(py::init<size_t>())
+        .def(py::init([](DoubleArray a) {
+            if (a.ndim() != 1) throw std::runtime_error("expected a 1-D array");
+            return Tensor(a.data(), static_cast<size_t>(a.shape(0)));
+        }))
+        .def_buffer([](Tensor &t) {
+            return py::buffer_info(t.data(), static_cast<py::ssize_t>(t.size()), !t.is_leaf());
+        })
+        .def("__len__", &Tensor::size)
+        .def("__getitem__", &Tensor::getitem)
+        .def("__setitem__", &Tensor::setitem)
+        .def("__repr__", &Tensor::info)
+        .def("grad", [](py::object self) {
+            Tensor &t = self.cast<Tensor &>();
+            return view(t.grad_data(), t.size(), self, false);
+        })
+        .def("values", [](py::object self) {
+            Tensor &t = self.cast<Tensor &>();
+            return view(t.data(), t.size(), self, t.is_leaf());
+        })
+        .def("backward", &Tensor::backward, nogil())
+        .def(py::self + py::self, nogil())
+        .def(double() + py::self, nogil())
+        .def(py::self + double(), nogil())
+        .def(py::self - py::self, nogil())
+        .def(double() - py::self, nogil())
+        .def(py::self - double(), nogil())
+        .def(py::self * py::self, nogil())
+        .def(double() * py::self, nogil())
+        .def(py::self * double(), nogil())
+        .def(py::self / py::self, nogil())
+        .def(double() / py::self, nogil())
+        .def(py::self / double(), nogil())
+        .def(-py::self, nogil())
+        .def("sin", &Tensor::sin, nogil())
+        .def("cos", &Tensor::cos, nogil())
+        .def("tan", &Tensor::tan, nogil())
+        .def("exp", &Tensor::exp, nogil())
+        .def("log", &Tensor::log, nogil())
+        .def("sqrt", &Tensor::sqrt, nogil())
+        .def("abs", &Tensor::abs, nogil());
+
+    // values() and grad() are copies: a transposed view has no row-major buffer.
+    py::class_<Matrix>(m, "mat")
+        .def(py::init<size_t, size_t>())
+        .def(py::init([](DoubleArray a) {
+            if (a.ndim() != 2) throw std::runtime_error("expected a 2-D array");
+            return Matrix(a.data(), static_cast<size_t>(a.shape(0)), static_cast<size_t>(a.shape(1)));
+        }))
+        .def_property_readonly("shape", [](const Matrix &a) { return py::make_tuple(a.rows(), a.cols()); })
+        .def_property_readonly("T", &Matrix::t)
+        .def("t", &Matrix::t)
+        .def("__len__", &Matrix::rows)
+        .def("__getitem__", [](const Matrix &a, std::pair<size_t, size_t> ij) { return a.get(ij.first, ij.second); })
+        .def("__repr__", &Matrix::info)
+        .def("values", [](const Matrix &a) { return array2d(a.values(), a.rows(), a.cols()); })
+        .def("grad", [](const Matrix &a) { return array2d(a.grad(), a.rows(), a.cols()); })
+        .def("tensor", &Matrix::tensor)
+        .def("backward", &Matrix::backward, nogil())
+        .def("__matmul__", [](const Matrix &a, const Matrix &b) { return matmul(a, b); }, nogil())
+        .def("__matmul__", [](const Matrix &a, const Tensor &x) { return matvec(a, x); }, nogil())
+        .def(py::self + py::self, nogil())
+        .def(py::self + double(), nogil())
+        .def(py::self - py::self, nogil())
+        .def(py::self - double(), nogil())
+        .def(py::self * py::self, nogil())
+        .def(py::self * double(), nogil())
+        .def(py::self / py::self, nogil())
+        .def(py::self / double(), nogil());
+    m.def("matmul", &matmul, nogil());
+    m.def("matvec", &matvec, nogil());
+
+    // Rows are outputs, columns inputs.
+    m.def("jacobian", [](const Vector &outputs, const Vector &inputs) {
+        std::vector<double> jac;
+        {
+            py::gil_scoped_release release;
+            jac = jacobian(outputs, inputs);
+        }
+        py::array_t<double> res({ static_cast<py::ssize_t>(outputs.size()), static_cast<py::ssize_t>(inputs.size()) });
+        std::copy(jac.begin(), jac.end(), res.mutable_data());
+        return res;
+    }, py::arg("outputs"), py::arg("inputs"));
+
+    m.def("checkpoint", [](py::function fn, const Vector &inputs) {
+        return checkpoint(segment(fn), inputs);
+    }, py::arg("fn"), py::arg("inputs"));
+    m.def("checkpoint_steps", [](py::function step, const Vector &inputs, size_t steps, size_t budget) {
+        return checkpoint_steps(segment(step), inputs, steps, budget);
+    }, py::arg("step"), py::arg("inputs"), py::arg("steps"), py::arg("budget") = 0);
+
+    // CSR arrays in the layout scipy.sparse.csr_matrix((data, indices, indptr), shape) takes.
+    py::class_<SparseMatrix>(m, "sparse")
+        .def_property_readonly("shape", [](const SparseMatrix &s) { return py::make_tuple(s.rows, s.cols); })
+        .def_property_readonly("nnz", &SparseMatrix::nonzeros)
+        .def_property_readonly("data", [](const SparseMatrix &s) {
+            return py::array_t<double>(static_cast<py::ssize_t>(s.values.size()), s.values.data());
+        })
+        .def_property_readonly("indices", [](const SparseMatrix &s) { return index_array(s.indices); })
+        .def_property_readonly("indptr", [](const SparseMatrix &s) { return index_array(s.offsets); })
+        .def("todense", [](const SparseMatrix &s) {
+            std::vector<double> d = s.dense();
+            py::array_t<double> res({ static_cast<py::ssize_t>(s.rows), static_cast<py::ssize_t>(s.cols) });
+            std::copy(d.begin(), d.end(), res.mutable_data());
+            return res;
+        });
+    m.def("sparse_jacobian", [](const Vector &outputs, const Vector &inputs, size_t lanes) {
+        py::gil_scoped_release release;
+        return sparse_jacobian(outputs, inputs, lanes);
+    }, py::arg("outputs"), py::arg("inputs"), py::arg("lanes") = 16);
+
+    // Second order, for the sum of the output's elements.
+    m.def("hvp", [](const Vector &output, const Vector &inputs, DoubleArray v) {
+        if (static_cast<size_t>(v.size()) != inputs.size()) throw std::runtime_error("size not same");
+        std::vector<double> dir(v.data(), v.data() + v.size()), res;
+        {
+            py::gil_scoped_release release;
+            res = hvp(output, inputs, dir);
+        }
+        py::array_t<double> out(res.size());
+        std::copy(res.begin(), res.end(), out.mutable_data());
+        return out;
+    }, py::arg("output"), py::arg("inputs"), py::arg("v"));
+    m.def("hessian", [](const Vector &output, const Vector &inputs) {
+        std::vector<double> h;
+        {
+            py::gil_scoped_release release;
+            h = hessian(output, inputs);
+        }
+        const py::ssize_t n = static_cast<py::ssize_t>(inputs.size());
+        py::array_t<double> res({ n, n });
+        std::copy(h.begin(), h.end(), res.mutable_data());
+        return res;
+    }, py::arg("output"), py::arg("inputs"));
+
+    // Graph traced once from vec inputs to a vec output, replayed on new values.
+    py::class_<CompiledFunction>(m, "compiled")
+        .def(py::init([](const std::vector<const Vector *> &inputs, const Vector &output) {
+            return CompiledFunction(inputs, output);
+        }), py::arg("inputs"), py::arg("output"))
+        .def("__len__", &CompiledFunction::size)
+        .def_property_readonly("inputs", &CompiledFunction::inputs)
+        .def_property_readonly("outputs", &CompiledFunction::outputs)
+        .def("forward", [](CompiledFunction &f, const std::vector<DoubleArray> &arrays) {
+            std::vector<double> x;
+            x.reserve(f.inputs());
+            for (const DoubleArray &a : arrays) x.insert(x.end(), a.data(), a.data() + a.size());
+            if (x.size() != f.inputs()) throw std::runtime_error("input size not same");
+            py::array_t<double> y(f.outputs());
+            double *out = y.mutable_data();
+            {
+                py::gil_scoped_release release;
+                f.forward(x.data(), out);
+            }
+            return y;
+        })
+        .def("backward", [](CompiledFunction &f, DoubleArray seeds) {
+            if (static_cast<size_t>(seeds.size()) != f.outputs()) throw std::runtime_error("seed size not same");
+            py::array_t<double> grad(f.inputs());
+            double *out = grad.mutable_data();
+            {
+                py::gil_scoped_release release;
+                f.backward(seeds.data(), out);
+            }
+            return grad;
+        });
+    m.def("compile", [](const std::vector<const Vector *> &inputs, const Vector &output) {
+        return CompiledFunction(inputs, output);
+    }, py::arg("inputs"), py::arg("output"));
+
+    // Profiling counters; all zero unless built with AUTODIFF_PROFILE (make PROFILE=1).
+    m.def("stats", [] {
+        Stats s = stats();
+        py::dict nodes, seconds;
+        for (size_t i=0; i < s.nodes.size(); i++) nodes[opcode_name(static_cast<OpCode>(i))] = s.nodes[i];
+        for (size_t i=0; i < s.seconds.size(); i++) seconds[phase_name(static_cast<Phase>(i))] = s.seconds[i];
+        py::dict res;
+        res["enabled"] = profiling_enabled;
+        res["nodes"] = nodes;
+        res["bytes"] = s.bytes;
+        res["visited"] = s.visited;
+        res["recorded"] = s.recorded;
+        res["swept"] = s.swept;
+        res["seconds"] = seconds;
+        return res;
+    });
+    m.def("reset_stats", &reset_stats);
+
+    // Backward passes of several independent vec graphs, run concurrently on
+    // the native thread pool.
+    m.def("backward_many", [](const std::vector<Vector *> &outputs) {
+        backward_many(outputs);
+    }, py::arg("outputs"), nogil());
+
+    // Resizes the native thread pool. Loops running on it finish first, so
+    // this releases the GIL while it waits.
+    m.def("set_num_threads", &ThreadPool::set_num_threads, py::arg("threads"), nogil());
+    m.def("num_threads", [] { return ThreadPool::instance().size(); });
+
+    bind_flat<double, double>(m, "float64");
+    bind_flat<float, float>(m, "float32");
+    bind_flat<float, double>(m, "mixed");
+
+    // graph(dtype=numpy.float32) records float values and partials; "mixed"
+    // keeps them in float but accumulates gradients in double. The dtype is
+    // chosen per graph rather than per vec because every vec on a graph
+    // shares its record array, and ops between vecs must agree on it.
+    m.def("graph", [m](py::object dtype) -> py::object {
+        return m.attr(("graph_" + precision(dtype)).c_str())();
+    }, py::arg("dtype") = "float64");
 }
 
 
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include <autodiff/profile.hpp>
+
+namespace autodiff {
+
+// Scoped bump allocator for graph nodes. While a GraphArena is alive, every
+// node created on the same thread is carved out of its blocks instead of the
+// heap, and the whole graph's memory is released at once when it goes out of
+// scope. Nodes built inside the scope must not outlive the arena; leaves made
+// before it are fine since they never reference their consumers.
+class GraphArena {
+ public:
+    explicit GraphArena(size_t blockSize = 1 << 20)
+      : m_blockSize(blockSize), m_previous(current()) {
+        current() = this;
+    }
+
+    ~GraphArena() {
+        if (!m_child) current() = m_previous;
+    }
+
+    GraphArena(const GraphArena &) = delete;
+    GraphArena& operator=(const GraphArena &) = delete;
+
+    void *allocate(size_t bytes, size_t alignment) {
+        size_t space = static_cast<size_t>(m_end - m_cursor);
+        void *p = m_cursor;
+        if (!m_cursor || !std::align(alignment, bytes, p, space)) {
+            size_t blockSize = std::max(m_blockSize, bytes + alignment);
+            m_blocks.emplace_back(new char[blockSize]);
+            m_cursor = m_blocks.back().get();
+            m_end = m_cursor + blockSize;
+            space = blockSize;
+            p = m_cursor;
+            std::align(alignment, bytes, p, space);
+        }
+        m_cursor = static_cast<char *>(p) + bytes;
+        m_allocations++;
+        m_bytes += bytes;
+        return p;
+    }
+
+    size_t allocations() const {
+        size_t total = m_allocations;
+        for (const auto &child : m_children) total += child->allocations();
+        return total;
+    }
+
+    size_t bytes() const {
+        size_t total = m_bytes;
+        for (const auto &child : m_children) total += child->bytes();
+        return total;
+    }
+
+    // Makes a sub-arena of `parent` current on the calling thread for the
+    // lease's lifetime, so work fanned out to other threads keeps allocating
+    // in the parent's scope without sharing its cursor. Sub-arenas are reused
+    // by later leases and freed together with the parent.
+    class Lease {
+     public:
+        explicit Lease(GraphArena *parent)
+          : m_parent(parent), m_arena(parent ? parent->acquire() : nullptr), m_previous(current()) {
+            if (m_arena) current() = m_arena;
+        }
+
+        ~Lease() {
+            if (!m_arena) return;
+            current() = m_previous;
+            m_parent->release(m_arena);
+        }
+
+        Lease(const Lease &) = delete;
+        Lease& operator=(const Lease &) = delete;
+
+     private:
+        GraphArena *m_parent;
+        GraphArena *m_arena;
+        GraphArena *m_previous;
+    };
+
+    // Innermost arena alive on the calling thread, or nullptr.
+    static GraphArena *&current() {
+        static thread_local GraphArena *arena = nullptr;
+        return arena;
+    }
+
+ private:
+    struct ChildTag {};
+
+    GraphArena(size_t blockSize, ChildTag)
+      : m_blockSize(blockSize), m_previous(nullptr), m_child(true) {}
+
+    GraphArena *acquire() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_idle.empty()) {
+            m_children.emplace_back(new GraphArena(m_blockSize, ChildTag()));
+            return m_children.back().get();
+        }
+        GraphArena *child = m_idle.back();
+        m_idle.pop_back();
+        return child;
+    }
+
+    void release(GraphArena *child) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(child);
+    }
+
+    size_t m_blockSize;
+    GraphArena *m_previous;
+    bool m_child = false;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<GraphArena>> m_children;
+    std::vector<GraphArena *> m_idle;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char *m_cursor = nullptr;
+    char *m_end = nullptr;
+    size_t m_allocations = 0;
+    size_t m_bytes = 0;
+};
+
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    GraphArena *arena;
+
+    explicit ArenaAllocator(GraphArena *a) : arena(a) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &o) : arena(o.arena) {}  // NOLINT(runtime/explicit)
+
+    T *allocate(size_t n) {
+        profile::allocated(n * sizeof(T));
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T *, size_t) { /* released with the arena */ }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &o) const { return arena == o.arena; }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &o) const { return arena != o.arena; }
+};
+
+// Plain heap allocator that reports to the profiling counters. Being
+// stateless, it adds nothing to the node's control block.
+template <class T>
+struct HeapAllocator {
+    using value_type = T;
+
+    HeapAllocator() {}
+    template <class U>
+    HeapAllocator(const HeapAllocator<U> &) {}  // NOLINT(runtime/explicit)
+
+    T *allocate(size_t n) {
+        profile::allocated(n * sizeof(T));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    template <class U>
+    bool operator==(const HeapAllocator<U> &) const { return true; }
+    template <class U>
+    bool operator!=(const HeapAllocator<U> &) const { return false; }
+};
+
+// Allocates a node from the current arena if there is one, else from the heap.
+template <class T, class... Args>
+std::shared_ptr<T> make_node(Args&&... args) {
+    profile::Timer timer(Phase::Construct);
+    std::shared_ptr<T> node;
+    if (GraphArena *arena = GraphArena::current()) {
+        node = std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+    } else {
+        node = std::allocate_shared<T>(HeapAllocator<T>(), std::forward<Args>(args)...);
+    }
+    profile::created(*node);
+    return node;
+}
+
+}  // namespace autodiff
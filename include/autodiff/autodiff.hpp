@@ -1,7 +1,21 @@
 #pragma once
 
+#include <autodiff/arena.hpp>
 #include <autodiff/node.hpp>
+#include <autodiff/profile.hpp>
+#include <autodiff/tape.hpp>
+#include <autodiff/thread_pool.hpp>
+#include <autodiff/parallel.hpp>
 #include <autodiff/operators.hpp>
 #include <autodiff/mathfunctions.hpp>
 #include <autodiff/variable.hpp>
 #include <autodiff/vector.hpp>
+#include <autodiff/tensor.hpp>
+#include <autodiff/matrix.hpp>
+#include <autodiff/dual.hpp>
+#include <autodiff/expression.hpp>
+#include <autodiff/compiled.hpp>
+#include <autodiff/hessian.hpp>
+#include <autodiff/sparse.hpp>
+#include <autodiff/checkpoint.hpp>
+#include <autodiff/flat.hpp>
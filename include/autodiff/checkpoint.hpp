@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <autodiff/node.hpp>
+#include <autodiff/variable.hpp>
+#include <autodiff/vector.hpp>
+
+namespace autodiff {
+
+// A function from Vector to Vector whose graph checkpoint() may rebuild.
+using Segment = std::function<Vector(Vector &)>;
+
+// Stands for a whole segment in the outer graph, with the segment's inputs as
+// operands. The segment is run on fresh leaves holding the inputs' values and
+// only its output values are kept; its own graph is released. In a backward
+// sweep the output nodes hand their adjoints over through receive(), and the
+// segment node, reached after all of them, rebuilds the segment, sweeps it
+// seeded with those adjoints and reports the leaves' gradients as partials.
+struct SegmentNode: Node {
+    std::vector<std::shared_ptr<Node>> inputs;
+    Segment fn;
+    std::vector<double> outputs;
+    std::vector<double> seeds;
+    std::vector<double> grads;
+
+    SegmentNode(const std::vector<std::shared_ptr<Node>> &in, const Segment &f)
+      : Node(0.0), inputs(in), fn(f), grads(in.size(), 0.0) {
+        evaluate();
+        seeds.assign(outputs.size(), 0.0);
+    }
+    ~SegmentNode() { detail::release_operands(*this); }
+
+    OpCode opcode() const override { return OpCode::Checkpoint; }
+    size_t arity() const override { return inputs.size(); }
+    Node *operand(size_t i) const override { return inputs[i].get(); }
+    void partials(double *out) const override {
+        std::copy(grads.begin(), grads.end(), out);
+    }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override {
+        for (auto &input : inputs) detail::detach_unique(input, out);
+    }
+
+    void evaluate() override {
+        Vector x = leaves();
+        Vector y = fn(x);
+        outputs.resize(y.size());
+        y.values(outputs.data());
+    }
+
+    double receive(const double &) override {
+        if (std::any_of(seeds.begin(), seeds.end(), [](double s) { return s != 0.0; })) {
+            Vector x = leaves();
+            Vector y = fn(x);
+            if (y.size() != seeds.size()) throw std::runtime_error("checkpointed segment changed size");
+            y.backward(seeds);
+            x.grad(grads.data());
+        } else {
+            std::fill(grads.begin(), grads.end(), 0.0);
+        }
+        std::fill(seeds.begin(), seeds.end(), 0.0);
+        return 1.0;
+    }
+
+ private:
+    Vector leaves() const {
+        std::vector<double> values(inputs.size());
+        for (size_t i=0; i < inputs.size(); i++) values[i] = inputs[i]->value;
+        return Vector(values.data(), values.size());
+    }
+};
+
+// Element `index` of a segment's output.
+struct CheckpointNode: Node {
+    std::shared_ptr<SegmentNode> segment;
+    size_t index;
+
+    CheckpointNode(const std::shared_ptr<SegmentNode> &s, size_t i)
+      : Node(s->outputs[i]), segment(s), index(i) {}
+    ~CheckpointNode() { detail::release_operands(*this); }
+
+    OpCode opcode() const override { return OpCode::Checkpoint; }
+    size_t arity() const override { return 1; }
+    Node *operand(size_t) const override { return segment.get(); }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override {
+        detail::detach_unique(segment, out);
+    }
+    void partials(double *out) const override {
+        out[0] = 1.0;
+    }
+    void evaluate() override {
+        value = segment->outputs[index];
+    }
+    double receive(const double &adjoint) override {
+        segment->seeds[index] = adjoint;
+        return 1.0;
+    }
+};
+
+// fn(inputs), holding only the inputs and output values alive instead of the
+// graph fn builds; that graph is rebuilt once per backward sweep that reaches
+// it. fn must be deterministic and must not read other Vectors it needs
+// gradients for: only `inputs` are differentiated through. Nodes allocated
+// in a GraphArena stay until the arena is reset, so checkpointing inside one
+// saves nothing.
+//
+// Checkpointed graphs support single-lane sweeps only (backward(), jacobian
+// with lanes = 1); they cannot be compiled or differentiated twice.
+inline Vector checkpoint(const Segment &fn, const Vector &inputs) {
+    std::vector<std::shared_ptr<Node>> in;
+    in.reserve(inputs.size());
+    for (size_t i=0; i < inputs.size(); i++) in.push_back(inputs[i].VarNodePtr);
+    auto segment = make_node<SegmentNode>(in, fn);
+    Vector res(segment->outputs.size());
+    for (size_t i=0; i < res.size(); i++) res[i] = make_node<CheckpointNode>(segment, i);
+    return res;
+}
+
+namespace detail {
+
+// `steps` applications of step split into `split` checkpointed segments,
+// each split the same way again for `depth` - 1 more levels.
+inline Vector checkpoint_levels(const Segment &step, const Vector &inputs, size_t steps, size_t split,
+                                size_t depth) {
+    if (depth == 0 || steps <= 1) {
+        Vector x = inputs;
+        for (size_t i=0; i < steps; i++) x = step(x);
+        return x;
+    }
+    Vector x = inputs;
+    const size_t length = (steps + split - 1) / split;
+    for (size_t first=0; first < steps; first += length) {
+        const size_t n = std::min(length, steps - first);
+        x = checkpoint([=](Vector &v) { return checkpoint_levels(step, v, n, split, depth - 1); }, x);
+    }
+    return x;
+}
+
+}  // namespace detail
+
+// `steps` applications of step, e.g. time steps of a simulation, scheduled so
+// that at most about `budget` step results are alive at once during backward.
+//
+// With one level the steps are cut into k = ceil(sqrt(steps)) checkpointed
+// segments: k boundaries stay alive, plus the k steps of the one segment
+// being rebuilt, for one extra forward pass. A smaller budget nests d levels
+// of k = ceil(steps^(1/(d+1))) segments each, keeping about (d+1) k results
+// for d extra forward passes; this is the uniform multi-level relative of
+// Revolve's binomial schedule. A budget of 0 picks the one-level schedule,
+// and budgets below about 2 log2(steps) get the deepest, k = 2, schedule.
+inline Vector checkpoint_steps(const Segment &step, const Vector &inputs, size_t steps, size_t budget = 0) {
+    if (steps <= 1) return detail::checkpoint_levels(step, inputs, steps, 1, 0);
+    auto split = [&](size_t depth) {
+        size_t k = static_cast<size_t>(std::ceil(std::pow(static_cast<double>(steps), 1.0 / (depth + 1))));
+        while (k > 2 && std::pow(static_cast<double>(k - 1), static_cast<double>(depth + 1)) >= steps) k--;
+        return std::max<size_t>(k, 2);
+    };
+    if (budget == 0) return detail::checkpoint_levels(step, inputs, steps, split(1), 1);
+
+    size_t depth = 0;
+    while (split(depth) > 2 && (depth + 1) * split(depth) > budget) depth++;
+    return detail::checkpoint_levels(step, inputs, steps, split(depth), depth);
+}
+
+}  // namespace autodiff
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <autodiff/node.hpp>
+#include <autodiff/tape.hpp>
+#include <autodiff/vector.hpp>
+
+namespace autodiff {
+
+// Graph recorded once into a flat instruction array and replayed on new
+// input values. Each instruction is an opcode with up to two operand slots
+// into a value buffer laid out in tape order, or for reductions an offset
+// and count into a shared operand list; leaves listed as inputs read
+// from the input buffer, every other leaf keeps the value it was traced
+// with. The traced graph is not referenced afterwards.
+//
+// forward() and backward() work on buffers sized at construction and do not
+// allocate. One instance must not be replayed from two threads at once.
+class CompiledFunction {
+ public:
+    CompiledFunction(const std::vector<Node *> &inputs, const std::vector<Node *> &outputs) {
+        compile(inputs, outputs);
+    }
+
+    // Inputs are the elements of each Vector in turn; outputs are the
+    // elements of `output`.
+    CompiledFunction(const std::vector<const Vector *> &inputs, const Vector &output) {
+        std::vector<Node *> leaves;
+        for (const Vector *v : inputs) {
+            std::vector<Node *> r = v->roots();
+            leaves.insert(leaves.end(), r.begin(), r.end());
+        }
+        compile(leaves, output.roots());
+    }
+
+    size_t inputs() const { return m_inputs; }
+    size_t outputs() const { return m_outputs.size(); }
+    size_t size() const { return m_code.size(); }
+
+    // Evaluates the graph at x (inputs() values) and writes outputs() values to y.
+    void forward(const double *x, double *y) {
+        double *v = m_values.data();
+        double *aux = m_aux.data();
+        for (size_t i=0; i < m_code.size(); i++) {
+            const Instruction &in = m_code[i];
+            switch (in.op) {
+            case OpCode::Variable: v[i] = x[in.a]; break;
+            case OpCode::Constant: break;
+            case OpCode::Copy: v[i] = v[in.a]; break;
+            case OpCode::Add: v[i] = v[in.a] + v[in.b]; break;
+            case OpCode::Sub: v[i] = v[in.a] - v[in.b]; break;
+            case OpCode::Mul: v[i] = v[in.a] * v[in.b]; break;
+            case OpCode::Div: v[i] = v[in.a] / v[in.b]; break;
+            case OpCode::Neg: v[i] = -v[in.a]; break;
+            case OpCode::Sin: v[i] = std::sin(v[in.a]); aux[i] = std::cos(v[in.a]); break;
+            case OpCode::Cos: v[i] = std::cos(v[in.a]); aux[i] = -std::sin(v[in.a]); break;
+            case OpCode::Tan: v[i] = std::tan(v[in.a]); break;
+            case OpCode::Exp: v[i] = std::exp(v[in.a]); break;
+            case OpCode::Log: v[i] = std::log(v[in.a]); break;
+            case OpCode::Sqrt: v[i] = std::sqrt(v[in.a]); break;
+            case OpCode::Abs: v[i] = std::abs(v[in.a]); break;
+            case OpCode::AddConst: v[i] = v[in.a] + in.c; break;
+            case OpCode::SubConst: v[i] = v[in.a] - in.c; break;
+            case OpCode::RSubConst: v[i] = in.c - v[in.a]; break;
+            case OpCode::MulConst: v[i] = v[in.a] * in.c; break;
+            case OpCode::DivConst: v[i] = v[in.a] / in.c; break;
+            case OpCode::RDivConst: v[i] = in.c / v[in.a]; break;
+            case OpCode::Sum:
+            case OpCode::Mean: {
+                const uint32_t *l = &m_lists[in.a];
+                for (uint32_t k=0; k < in.b; k++) m_terms[k] = v[l[k]];
+                v[i] = detail::pairwise_sum(m_terms.data(), in.b);
+                if (in.op == OpCode::Mean) v[i] /= in.b;
+                break;
+            }
+            case OpCode::Dot: {
+                const uint32_t *l = &m_lists[in.a];
+                for (uint32_t k=0; k < in.b; k++) m_terms[k] = v[l[k]] * v[l[in.b + k]];
+                v[i] = detail::pairwise_sum(m_terms.data(), in.b);
+                break;
+            }
+            case OpCode::Norm: {
+                const uint32_t *l = &m_lists[in.a];
+                for (uint32_t k=0; k < in.b; k++) m_terms[k] = v[l[k]] * v[l[k]];
+                v[i] = std::sqrt(detail::pairwise_sum(m_terms.data(), in.b));
+                break;
+            }
+            default: throw std::logic_error("opcode rejected by compile()");
+            }
+        }
+        for (size_t k=0; k < m_outputs.size(); k++) y[k] = v[m_outputs[k]];
+    }
+
+    // Gradient, at the point of the last forward(), of sum_k seeds[k] * y[k]
+    // with respect to the inputs; written to grad (inputs() values).
+    void backward(const double *seeds, double *grad) {
+        const double *v = m_values.data();
+        const double *aux = m_aux.data();
+        double *adj = m_adjoints.data();
+        std::fill(m_adjoints.begin(), m_adjoints.end(), 0.0);
+        std::fill(grad, grad + m_inputs, 0.0);
+        for (size_t k=0; k < m_outputs.size(); k++) adj[m_outputs[k]] += seeds[k];
+
+        for (size_t i=m_code.size(); i-- > 0;) {
+            const Instruction &in = m_code[i];
+            const double g = adj[i];
+            switch (in.op) {
+            case OpCode::Variable: grad[in.a] += g; break;
+            case OpCode::Constant: break;
+            case OpCode::Copy: adj[in.a] += g; break;
+            case OpCode::Add: adj[in.a] += g; adj[in.b] += g; break;
+            case OpCode::Sub: adj[in.a] += g; adj[in.b] -= g; break;
+            case OpCode::Mul: adj[in.a] += g * v[in.b]; adj[in.b] += g * v[in.a]; break;
+            case OpCode::Div:
+                adj[in.a] += g / v[in.b];
+                adj[in.b] -= g * v[i] / v[in.b];
+                break;
+            case OpCode::Neg: adj[in.a] -= g; break;
+            case OpCode::Sin:
+            case OpCode::Cos: adj[in.a] += g * aux[i]; break;
+            case OpCode::Tan: adj[in.a] += g * (1.0 + v[i] * v[i]); break;
+            case OpCode::Exp: adj[in.a] += g * v[i]; break;
+            case OpCode::Log: adj[in.a] += g / v[in.a]; break;
+            case OpCode::Sqrt: adj[in.a] += g * 0.5 / v[i]; break;
+            case OpCode::Abs:
+                if (v[in.a] > 0.0) {
+                    adj[in.a] += g;
+                } else if (v[in.a] < 0.0) {
+                    adj[in.a] -= g;
+                }
+                break;
+            case OpCode::AddConst:
+            case OpCode::SubConst: adj[in.a] += g; break;
+            case OpCode::RSubConst: adj[in.a] -= g; break;
+            case OpCode::MulConst: adj[in.a] += g * in.c; break;
+            case OpCode::DivConst: adj[in.a] += g / in.c; break;
+            case OpCode::RDivConst: adj[in.a] -= g * v[i] / v[in.a]; break;
+            case OpCode::Sum:
+            case OpCode::Mean: {
+                const uint32_t *l = &m_lists[in.a];
+                const double w = in.op == OpCode::Mean ? g / in.b : g;
+                for (uint32_t k=0; k < in.b; k++) adj[l[k]] += w;
+                break;
+            }
+            case OpCode::Dot: {
+                const uint32_t *l = &m_lists[in.a];
+                for (uint32_t k=0; k < in.b; k++) {
+                    adj[l[k]] += g * v[l[in.b + k]];
+                    adj[l[in.b + k]] += g * v[l[k]];
+                }
+                break;
+            }
+            case OpCode::Norm: {
+                if (v[i] == 0.0) break;
+                const uint32_t *l = &m_lists[in.a];
+                const double w = g / v[i];
+                for (uint32_t k=0; k < in.b; k++) adj[l[k]] += w * v[l[k]];
+                break;
+            }
+            default: throw std::logic_error("opcode rejected by compile()");
+            }
+        }
+    }
+
+    std::vector<double> forward(const std::vector<double> &x) {
+        if (x.size() != inputs()) throw std::runtime_error("input size not same");
+        std::vector<double> y(outputs());
+        forward(x.data(), y.data());
+        return y;
+    }
+
+    std::vector<double> backward(const std::vector<double> &seeds) {
+        if (seeds.size() != outputs()) throw std::runtime_error("seed size not same");
+        std::vector<double> grad(inputs());
+        backward(seeds.data(), grad.data());
+        return grad;
+    }
+
+ private:
+    struct Instruction {
+        OpCode op;
+        uint32_t a, b;
+        double c;  // inline constant of the *Const ops
+    };
+
+    // Operators the interpreters implement; leaves are checked separately.
+    static bool compilable(OpCode op) {
+        switch (op) {
+        case OpCode::Constant:
+        case OpCode::Variable:
+        case OpCode::Fused:
+        case OpCode::Checkpoint:
+        case OpCode::Count:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    void compile(const std::vector<Node *> &inputs, const std::vector<Node *> &outputs) {
+        std::unordered_map<const Node *, uint32_t> inputIndex;
+        for (size_t k=0; k < inputs.size(); k++) {
+            if (inputs[k]->arity() != 0) throw std::runtime_error("compiled inputs must be leaves");
+            inputIndex.emplace(inputs[k], static_cast<uint32_t>(k));
+        }
+
+        Tape tape(outputs);
+        m_inputs = inputs.size();
+        m_code.resize(tape.size());
+        m_values.resize(tape.size());
+        m_aux.assign(tape.size(), 0.0);
+        m_adjoints.resize(tape.size());
+
+        for (size_t i=0; i < tape.size(); i++) {
+            const Node *node = tape.node(i);
+            Instruction &in = m_code[i];
+            in.op = node->opcode();
+            in.a = tape.arity(i) > 0 ? static_cast<uint32_t>(tape.operand(i, 0)) : 0;
+            in.b = tape.arity(i) > 1 ? static_cast<uint32_t>(tape.operand(i, 1)) : 0;
+            in.c = 0.0;
+            m_values[i] = node->value;
+
+            if (tape.arity(i) > 0 && !compilable(in.op)) {
+                throw std::runtime_error(in.op < OpCode::Count
+                    ? std::string(opcode_name(in.op)) + " nodes cannot be compiled"
+                    : std::string("node cannot be compiled"));
+            }
+            // sin and cos read their partial from aux, so a backward() with
+            // no forward() first uses the partials of the traced graph.
+            if (in.op == OpCode::Sin || in.op == OpCode::Cos) node->partials(&m_aux[i]);
+            if (in.op >= OpCode::AddConst && in.op <= OpCode::RDivConst) {
+                in.c = static_cast<const ConstOpNode *>(node)->c;
+            }
+            if (in.op >= OpCode::Sum) {
+                in.a = static_cast<uint32_t>(m_lists.size());
+                in.b = static_cast<uint32_t>(in.op == OpCode::Dot ? tape.arity(i) / 2 : tape.arity(i));
+                for (size_t k=0; k < tape.arity(i); k++) m_lists.push_back(static_cast<uint32_t>(tape.operand(i, k)));
+                m_terms.resize(std::max<size_t>(m_terms.size(), in.b));
+            }
+            if (tape.arity(i) == 0) {
+                auto it = inputIndex.find(node);
+                in.op = it == inputIndex.end() ? OpCode::Constant : OpCode::Variable;
+                in.a = it == inputIndex.end() ? 0 : it->second;
+            }
+        }
+
+        m_outputs.reserve(outputs.size());
+        for (size_t k=0; k < outputs.size(); k++) m_outputs.push_back(tape.root(k));
+    }
+
+    size_t m_inputs = 0;
+    std::vector<Instruction> m_code;
+    std::vector<uint32_t> m_lists;  // operands of reductions
+    std::vector<double> m_terms;  // gathered reduction terms
+    std::vector<size_t> m_outputs;
+    std::vector<double> m_values;
+    std::vector<double> m_aux;
+    std::vector<double> m_adjoints;
+};
+
+}  // namespace autodiff
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+namespace autodiff {
+
+// Forward-mode number carrying N tangent lanes next to its value. Seeding the
+// inputs with N directions and evaluating a function once yields N
+// Jacobian-vector products; nothing is allocated and no graph is built.
+template <size_t N>
+struct Dual {
+    double value;
+    std::array<double, N> tangent;
+
+    Dual() : Dual(0.0) {}
+
+    Dual(const double &v) : value(v) {  // NOLINT(runtime/explicit)
+        tangent.fill(0.0);
+    }
+
+    Dual(const double &v, const std::array<double, N> &t) : value(v), tangent(t) {}
+
+    // Input seeded with the unit direction of `lane`.
+    static Dual variable(const double &v, size_t lane) {
+        Dual d(v);
+        d.tangent[lane] = 1.0;
+        return d;
+    }
+
+    Dual& operator+=(const Dual &r) { return *this = *this + r; }
+    Dual& operator-=(const Dual &r) { return *this = *this - r; }
+    Dual& operator*=(const Dual &r) { return *this = *this * r; }
+    Dual& operator/=(const Dual &r) { return *this = *this / r; }
+};
+
+namespace detail {
+
+// f(x) with f'(x) = derivative: tangent is scaled lane by lane.
+template <size_t N>
+Dual<N> chain(const Dual<N> &x, const double &value, const double &derivative) {
+    Dual<N> res(value);
+    for (size_t i=0; i < N; i++) res.tangent[i] = derivative * x.tangent[i];
+    return res;
+}
+
+}  // namespace detail
+
+template <size_t N>
+Dual<N> operator+(const Dual<N> &l, const Dual<N> &r) {
+    Dual<N> res(l.value + r.value);
+    for (size_t i=0; i < N; i++) res.tangent[i] = l.tangent[i] + r.tangent[i];
+    return res;
+}
+
+template <size_t N>
+Dual<N> operator-(const Dual<N> &l, const Dual<N> &r) {
+    Dual<N> res(l.value - r.value);
+    for (size_t i=0; i < N; i++) res.tangent[i] = l.tangent[i] - r.tangent[i];
+    return res;
+}
+
+template <size_t N>
+Dual<N> operator*(const Dual<N> &l, const Dual<N> &r) {
+    Dual<N> res(l.value * r.value);
+    for (size_t i=0; i < N; i++) res.tangent[i] = l.tangent[i] * r.value + l.value * r.tangent[i];
+    return res;
+}
+
+template <size_t N>
+Dual<N> operator/(const Dual<N> &l, const Dual<N> &r) {
+    double recRight = 1.0 / r.value;
+    Dual<N> res(l.value * recRight);
+    for (size_t i=0; i < N; i++) res.tangent[i] = (l.tangent[i] - res.value * r.tangent[i]) * recRight;
+    return res;
+}
+
+template <size_t N>
+Dual<N> operator+(const Dual<N> &l) {
+    return l;
+}
+
+template <size_t N>
+Dual<N> operator-(const Dual<N> &l) {
+    return detail::chain(l, -l.value, -1.0);
+}
+
+template <size_t N>
+Dual<N> operator+(const Dual<N> &l, const double &r) { return Dual<N>(l.value + r, l.tangent); }
+
+template <size_t N>
+Dual<N> operator+(const double &l, const Dual<N> &r) { return Dual<N>(l + r.value, r.tangent); }
+
+template <size_t N>
+Dual<N> operator-(const Dual<N> &l, const double &r) { return Dual<N>(l.value - r, l.tangent); }
+
+template <size_t N>
+Dual<N> operator-(const double &l, const Dual<N> &r) { return detail::chain(r, l - r.value, -1.0); }
+
+template <size_t N>
+Dual<N> operator*(const Dual<N> &l, const double &r) { return detail::chain(l, l.value * r, r); }
+
+template <size_t N>
+Dual<N> operator*(const double &l, const Dual<N> &r) { return detail::chain(r, l * r.value, l); }
+
+template <size_t N>
+Dual<N> operator/(const Dual<N> &l, const double &r) { return detail::chain(l, l.value / r, 1.0 / r); }
+
+template <size_t N>
+Dual<N> operator/(const double &l, const Dual<N> &r) {
+    double value = l / r.value;
+    return detail::chain(r, value, -value / r.value);
+}
+
+template <size_t N>
+Dual<N> sin(const Dual<N> &l) {
+    return detail::chain(l, std::sin(l.value), std::cos(l.value));
+}
+
+template <size_t N>
+Dual<N> cos(const Dual<N> &l) {
+    return detail::chain(l, std::cos(l.value), -std::sin(l.value));
+}
+
+template <size_t N>
+Dual<N> tan(const Dual<N> &l) {
+    double value = std::tan(l.value);
+    return detail::chain(l, value, 1.0 + value * value);
+}
+
+template <size_t N>
+Dual<N> exp(const Dual<N> &l) {
+    double value = std::exp(l.value);
+    return detail::chain(l, value, value);
+}
+
+template <size_t N>
+Dual<N> log(const Dual<N> &l) {
+    return detail::chain(l, std::log(l.value), 1.0 / l.value);
+}
+
+template <size_t N>
+Dual<N> sqrt(const Dual<N> &l) {
+    double value = std::sqrt(l.value);
+    return detail::chain(l, value, 0.5 / value);
+}
+
+template <size_t N>
+Dual<N> abs(const Dual<N> &l) {
+    double sign = l.value > 0.0 ? 1.0 : (l.value < 0.0 ? -1.0 : 0.0);
+    return detail::chain(l, std::abs(l.value), sign);
+}
+
+}  // namespace autodiff
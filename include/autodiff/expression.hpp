@@ -0,0 +1,303 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <autodiff/arena.hpp>
+#include <autodiff/node.hpp>
+#include <autodiff/variable.hpp>
+
+namespace autodiff {
+
+// Single node standing for a whole fused expression: it keeps one operand
+// slot per leaf occurrence and the partials computed when it was built.
+// Having no formula left, it cannot be re-evaluated.
+template <size_t K>
+struct FusedNode: Node {
+    std::array<std::shared_ptr<Node>, K> operands;
+    std::array<double, K> local;
+
+    explicit FusedNode(const double &v) : Node(v) {
+        local.fill(0.0);
+    }
+    ~FusedNode() { detail::release_operands(*this); }
+
+    OpCode opcode() const override { return OpCode::Fused; }
+    size_t arity() const override { return K; }
+    Node *operand(size_t i) const override { return operands[i].get(); }
+    void partials(double *out) const override{
+        for (size_t i=0; i < K; i++) out[i] = local[i];
+    }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override{
+        for (auto &operand : operands) detail::detach_unique(operand, out);
+    }
+};
+
+// Opt-in expression templates. Wrapping the leaves of a formula with
+// expr::ref() makes `a * b + c` build a compile-time expression instead of
+// a node per op; converting it to std::shared_ptr<Node> (or assigning it to
+// a Variable) evaluates value and partials in one inlined pass and emits a
+// single FusedNode. Operands that are Variables or nodes become leaves too,
+// so the formula itself is written exactly as before.
+namespace expr {
+
+template <class E>
+struct Expr {
+    const E &self() const { return static_cast<const E &>(*this); }
+    operator std::shared_ptr<Node>() const;  // NOLINT(runtime/explicit)
+};
+
+struct Ref: Expr<Ref> {
+    enum { leaves = 1 };
+    std::shared_ptr<Node> node;
+    double value;
+
+    explicit Ref(const std::shared_ptr<Node> &n) : node(n), value(n->value) {}
+
+    void collect(std::shared_ptr<Node> *out) const { out[0] = node; }
+    void gradient(const double &adjoint, double *out) const { out[0] += adjoint; }
+};
+
+struct Constant: Expr<Constant> {
+    enum { leaves = 0 };
+    double value;
+
+    explicit Constant(const double &v) : value(v) {}
+
+    void collect(std::shared_ptr<Node> *) const {}
+    void gradient(const double &, double *) const {}
+};
+
+template <class Op, class L, class R>
+struct Binary: Expr<Binary<Op, L, R>> {
+    enum { leaves = L::leaves + R::leaves };
+    L left;
+    R right;
+    double value;
+
+    Binary(const L &l, const R &r) : left(l), right(r), value(Op::value(l.value, r.value)) {}
+
+    void collect(std::shared_ptr<Node> *out) const {
+        left.collect(out);
+        right.collect(out + L::leaves);
+    }
+
+    void gradient(const double &adjoint, double *out) const {
+        double dl, dr;
+        Op::partials(left.value, right.value, value, &dl, &dr);
+        left.gradient(adjoint * dl, out);
+        right.gradient(adjoint * dr, out + L::leaves);
+    }
+};
+
+template <class Op, class E>
+struct Unary: Expr<Unary<Op, E>> {
+    enum { leaves = E::leaves };
+    E m;
+    double value;
+
+    explicit Unary(const E &e) : m(e), value(Op::value(e.value)) {}
+
+    void collect(std::shared_ptr<Node> *out) const { m.collect(out); }
+
+    void gradient(const double &adjoint, double *out) const {
+        m.gradient(adjoint * Op::derivative(m.value, value), out);
+    }
+};
+
+struct Add {
+    static double value(const double &l, const double &r) { return l + r; }
+    static void partials(const double &, const double &, const double &, double *dl, double *dr) {
+        *dl = 1.0;
+        *dr = 1.0;
+    }
+};
+
+struct Sub {
+    static double value(const double &l, const double &r) { return l - r; }
+    static void partials(const double &, const double &, const double &, double *dl, double *dr) {
+        *dl = 1.0;
+        *dr = -1.0;
+    }
+};
+
+struct Mul {
+    static double value(const double &l, const double &r) { return l * r; }
+    static void partials(const double &l, const double &r, const double &, double *dl, double *dr) {
+        *dl = r;
+        *dr = l;
+    }
+};
+
+struct Div {
+    static double value(const double &l, const double &r) { return l / r; }
+    static void partials(const double &, const double &r, const double &v, double *dl, double *dr) {
+        *dl = 1.0 / r;
+        *dr = -v / r;
+    }
+};
+
+struct Neg {
+    static double value(const double &x) { return -x; }
+    static double derivative(const double &, const double &) { return -1.0; }
+};
+
+struct Sin {
+    static double value(const double &x) { return std::sin(x); }
+    static double derivative(const double &x, const double &) { return std::cos(x); }
+};
+
+struct Cos {
+    static double value(const double &x) { return std::cos(x); }
+    static double derivative(const double &x, const double &) { return -std::sin(x); }
+};
+
+struct Tan {
+    static double value(const double &x) { return std::tan(x); }
+    static double derivative(const double &, const double &v) { return 1.0 + v * v; }
+};
+
+struct Exp {
+    static double value(const double &x) { return std::exp(x); }
+    static double derivative(const double &, const double &v) { return v; }
+};
+
+struct Log {
+    static double value(const double &x) { return std::log(x); }
+    static double derivative(const double &x, const double &) { return 1.0 / x; }
+};
+
+struct Sqrt {
+    static double value(const double &x) { return std::sqrt(x); }
+    static double derivative(const double &, const double &v) { return 0.5 / v; }
+};
+
+struct Abs {
+    static double value(const double &x) { return std::abs(x); }
+    static double derivative(const double &x, const double &) {
+        return x > 0.0 ? 1.0 : (x < 0.0 ? -1.0 : 0.0);
+    }
+};
+
+inline Ref ref(const std::shared_ptr<Node> &n) { return Ref(n); }
+inline Ref ref(const Variable &v) { return Ref(v.VarNodePtr); }
+
+// Builds the fused node for an expression.
+template <class E>
+std::shared_ptr<Node> eval(const Expr<E> &e) {
+    const E &x = e.self();
+    auto node = make_node<FusedNode<E::leaves>>(x.value);
+    x.collect(node->operands.data());
+    x.gradient(1.0, node->local.data());
+    return node;
+}
+
+template <class E>
+Expr<E>::operator std::shared_ptr<Node>() const {
+    return eval(*this);
+}
+
+template <class Op, class L, class R>
+Binary<Op, L, R> binary(const L &l, const R &r) {
+    return Binary<Op, L, R>(l, r);
+}
+
+template <class L, class R>
+Binary<Add, L, R> operator+(const Expr<L> &l, const Expr<R> &r) { return binary<Add>(l.self(), r.self()); }
+template <class L>
+Binary<Add, L, Constant> operator+(const Expr<L> &l, const double &r) { return binary<Add>(l.self(), Constant(r)); }
+template <class R>
+Binary<Add, Constant, R> operator+(const double &l, const Expr<R> &r) { return binary<Add>(Constant(l), r.self()); }
+template <class L>
+Binary<Add, L, Ref> operator+(const Expr<L> &l, const Variable &r) { return binary<Add>(l.self(), ref(r)); }
+template <class R>
+Binary<Add, Ref, R> operator+(const Variable &l, const Expr<R> &r) { return binary<Add>(ref(l), r.self()); }
+template <class L>
+Binary<Add, L, Ref> operator+(const Expr<L> &l, const std::shared_ptr<Node> &r) {
+    return binary<Add>(l.self(), ref(r));
+}
+template <class R>
+Binary<Add, Ref, R> operator+(const std::shared_ptr<Node> &l, const Expr<R> &r) {
+    return binary<Add>(ref(l), r.self());
+}
+
+template <class L, class R>
+Binary<Sub, L, R> operator-(const Expr<L> &l, const Expr<R> &r) { return binary<Sub>(l.self(), r.self()); }
+template <class L>
+Binary<Sub, L, Constant> operator-(const Expr<L> &l, const double &r) { return binary<Sub>(l.self(), Constant(r)); }
+template <class R>
+Binary<Sub, Constant, R> operator-(const double &l, const Expr<R> &r) { return binary<Sub>(Constant(l), r.self()); }
+template <class L>
+Binary<Sub, L, Ref> operator-(const Expr<L> &l, const Variable &r) { return binary<Sub>(l.self(), ref(r)); }
+template <class R>
+Binary<Sub, Ref, R> operator-(const Variable &l, const Expr<R> &r) { return binary<Sub>(ref(l), r.self()); }
+template <class L>
+Binary<Sub, L, Ref> operator-(const Expr<L> &l, const std::shared_ptr<Node> &r) {
+    return binary<Sub>(l.self(), ref(r));
+}
+template <class R>
+Binary<Sub, Ref, R> operator-(const std::shared_ptr<Node> &l, const Expr<R> &r) {
+    return binary<Sub>(ref(l), r.self());
+}
+
+template <class L, class R>
+Binary<Mul, L, R> operator*(const Expr<L> &l, const Expr<R> &r) { return binary<Mul>(l.self(), r.self()); }
+template <class L>
+Binary<Mul, L, Constant> operator*(const Expr<L> &l, const double &r) { return binary<Mul>(l.self(), Constant(r)); }
+template <class R>
+Binary<Mul, Constant, R> operator*(const double &l, const Expr<R> &r) { return binary<Mul>(Constant(l), r.self()); }
+template <class L>
+Binary<Mul, L, Ref> operator*(const Expr<L> &l, const Variable &r) { return binary<Mul>(l.self(), ref(r)); }
+template <class R>
+Binary<Mul, Ref, R> operator*(const Variable &l, const Expr<R> &r) { return binary<Mul>(ref(l), r.self()); }
+template <class L>
+Binary<Mul, L, Ref> operator*(const Expr<L> &l, const std::shared_ptr<Node> &r) {
+    return binary<Mul>(l.self(), ref(r));
+}
+template <class R>
+Binary<Mul, Ref, R> operator*(const std::shared_ptr<Node> &l, const Expr<R> &r) {
+    return binary<Mul>(ref(l), r.self());
+}
+
+template <class L, class R>
+Binary<Div, L, R> operator/(const Expr<L> &l, const Expr<R> &r) { return binary<Div>(l.self(), r.self()); }
+template <class L>
+Binary<Div, L, Constant> operator/(const Expr<L> &l, const double &r) { return binary<Div>(l.self(), Constant(r)); }
+template <class R>
+Binary<Div, Constant, R> operator/(const double &l, const Expr<R> &r) { return binary<Div>(Constant(l), r.self()); }
+template <class L>
+Binary<Div, L, Ref> operator/(const Expr<L> &l, const Variable &r) { return binary<Div>(l.self(), ref(r)); }
+template <class R>
+Binary<Div, Ref, R> operator/(const Variable &l, const Expr<R> &r) { return binary<Div>(ref(l), r.self()); }
+template <class L>
+Binary<Div, L, Ref> operator/(const Expr<L> &l, const std::shared_ptr<Node> &r) {
+    return binary<Div>(l.self(), ref(r));
+}
+template <class R>
+Binary<Div, Ref, R> operator/(const std::shared_ptr<Node> &l, const Expr<R> &r) {
+    return binary<Div>(ref(l), r.self());
+}
+
+template <class E>
+const E &operator+(const Expr<E> &e) { return e.self(); }
+template <class E>
+Unary<Neg, E> operator-(const Expr<E> &e) { return Unary<Neg, E>(e.self()); }
+
+template <class E>
+Unary<Sin, E> sin(const Expr<E> &e) { return Unary<Sin, E>(e.self()); }
+template <class E>
+Unary<Cos, E> cos(const Expr<E> &e) { return Unary<Cos, E>(e.self()); }
+template <class E>
+Unary<Tan, E> tan(const Expr<E> &e) { return Unary<Tan, E>(e.self()); }
+template <class E>
+Unary<Exp, E> exp(const Expr<E> &e) { return Unary<Exp, E>(e.self()); }
+template <class E>
+Unary<Log, E> log(const Expr<E> &e) { return Unary<Log, E>(e.self()); }
+template <class E>
+Unary<Sqrt, E> sqrt(const Expr<E> &e) { return Unary<Sqrt, E>(e.self()); }
+template <class E>
+Unary<Abs, E> abs(const Expr<E> &e) { return Unary<Abs, E>(e.self()); }
+
+}  // namespace expr
+}  // namespace autodiff
@@ -0,0 +1,542 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <autodiff/node.hpp>
+
+namespace autodiff {
+
+// Alternative engine without polymorphic nodes. Every op appends a plain
+// record (opcode, operand indices, value and the partials computed with it)
+// to one contiguous array, in creation order, so the array is already a
+// tape: backward is a single reverse loop with a switch on the opcode and no
+// virtual call, hash lookup or sort. Variable and Vector mirror the API of
+// their node-based counterparts, retain mode included: records keep the
+// constant of const ops, so forward() can replay them in place.
+//
+// The engine is templated on the scalar type T of values and partials and
+// the type G of adjoints and gradients. Graph, Variable and Vector are the
+// double instantiations; the 32-bit ones store records of 24 instead of 40
+// bytes, so the bandwidth-bound backward loop moves 40% less memory, and
+// the mixed ones keep float records with double accumulators, so gradients
+// summed over many uses do not lose float precision.
+namespace flat {
+
+// db is the constant operand of AddConst and the other const ops.
+template <class T>
+struct Record {
+    OpCode op;
+    uint32_t a, b;
+    T value;
+    T da, db;
+};
+
+namespace detail {
+
+template <class T>
+struct Identity { using type = T; };
+
+// T as a parameter type that does not take part in deduction, so
+// `x * 2.0` converts the constant to a float graph's scalar type.
+template <class T>
+using Scalar = typename Identity<T>::type;
+
+}  // namespace detail
+
+// Append-only record array. Constructing a Graph makes it current on the
+// calling thread for its scope; outside any scope a per-thread default graph
+// is used. Leaves are created on the current graph and ops on their
+// operands' graph. Variables refer to records by index, so they must not
+// outlive their graph or a rewind() past them.
+template <class T, class G = T>
+class BasicGraph {
+ public:
+    using value_type = T;
+    using grad_type = G;
+
+    // Tag for a graph that is never made current; leaves go on it through
+    // the BasicVector constructor taking a graph.
+    struct Detached {};
+
+    BasicGraph() : m_previous(active()) {
+        active() = this;
+    }
+
+    explicit BasicGraph(Detached) : m_previous(nullptr) {}
+
+    ~BasicGraph() {
+        if (active() == this) active() = m_previous;
+    }
+
+    BasicGraph(const BasicGraph &) = delete;
+    BasicGraph& operator=(const BasicGraph &) = delete;
+
+    static BasicGraph &current() {
+        if (BasicGraph *g = active()) return *g;
+        static thread_local BasicGraph fallback(Detached{});
+        return fallback;
+    }
+
+    uint32_t push(OpCode op, uint32_t a, uint32_t b, T value, T da, T db) {
+        m_records.push_back(Record<T>{ op, a, b, value, da, db });
+        m_grad.push_back(G(0));
+        return static_cast<uint32_t>(m_records.size() - 1);
+    }
+
+    uint32_t leaf(T value) { return push(OpCode::Variable, 0, 0, value, T(0), T(0)); }
+
+    size_t size() const { return m_records.size(); }
+    const Record<T> &operator[](size_t i) const { return m_records[i]; }
+    T &value(size_t i) { return m_records[i].value; }
+    G &grad(size_t i) { return m_grad[i]; }
+
+    // Adds seeds[k] * d(root k)/d(leaf) to the grad of every leaf. Sweeps all
+    // records up to the newest root, skipping those with a zero adjoint.
+    void backward(const uint32_t *roots, const G *seeds, size_t n) {
+        if (!n) return;
+        uint32_t top = 0;
+        for (size_t k=0; k < n; k++) top = std::max(top, roots[k]);
+        m_adjoints.assign(top + 1, G(0));
+        for (size_t k=0; k < n; k++) m_adjoints[roots[k]] += seeds[k];
+
+        G *adj = m_adjoints.data();
+        const Record<T> *rec = m_records.data();
+        for (size_t i=top + 1; i-- > 0;) {
+            const G g = adj[i];
+            if (g == G(0)) continue;
+            const Record<T> &r = rec[i];
+            switch (r.op) {
+            case OpCode::Variable:
+                m_grad[i] += g;
+                break;
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+                adj[r.a] += G(r.da) * g;
+                adj[r.b] += G(r.db) * g;
+                break;
+            default:
+                adj[r.a] += G(r.da) * g;
+                break;
+            }
+        }
+    }
+
+    // Recomputes the values and partials of records before `end` from their
+    // operands, in creation order, after leaf values changed. Leaves keep
+    // their value.
+    void evaluate(size_t end) {
+        end = std::min(end, size());
+        Record<T> *rec = m_records.data();
+        for (size_t i=0; i < end; i++) {
+            Record<T> &r = rec[i];
+            if (r.op == OpCode::Variable) continue;
+            const T x = rec[r.a].value, y = rec[r.b].value, c = r.db;
+            switch (r.op) {
+            case OpCode::Add: r.value = x + y; break;
+            case OpCode::Sub: r.value = x - y; break;
+            case OpCode::Mul: r.value = x * y; r.da = y; r.db = x; break;
+            case OpCode::Div: r.da = T(1) / y; r.value = x / y; r.db = -r.value * r.da; break;
+            case OpCode::AddConst: r.value = x + c; break;
+            case OpCode::SubConst: r.value = x - c; break;
+            case OpCode::RSubConst: r.value = c - x; break;
+            case OpCode::MulConst: r.value = x * c; break;
+            case OpCode::DivConst: r.value = x / c; break;
+            case OpCode::RDivConst: r.value = c / x; r.da = -r.value / x; break;
+            case OpCode::Neg: r.value = -x; break;
+            case OpCode::Sin: r.value = std::sin(x); r.da = std::cos(x); break;
+            case OpCode::Cos: r.value = std::cos(x); r.da = -std::sin(x); break;
+            case OpCode::Tan: r.value = std::tan(x); r.da = T(1) + r.value * r.value; break;
+            case OpCode::Exp: r.value = std::exp(x); r.da = r.value; break;
+            case OpCode::Log: r.value = std::log(x); r.da = T(1) / x; break;
+            case OpCode::Sqrt: r.value = std::sqrt(x); r.da = T(0.5) / r.value; break;
+            case OpCode::Abs: r.value = std::abs(x); r.da = x > T(0) ? T(1) : (x < T(0) ? T(-1) : T(0)); break;
+            default: throw std::runtime_error("record cannot be replayed");
+            }
+        }
+    }
+
+    // Drops the records from `n` on, e.g. the ops of one optimizer step
+    // while keeping the parameters made before size() was n.
+    void rewind(size_t n = 0) {
+        m_records.resize(std::min(n, size()));
+        m_grad.resize(m_records.size());
+    }
+
+ private:
+    static BasicGraph *&active() {
+        static thread_local BasicGraph *graph = nullptr;
+        return graph;
+    }
+
+    BasicGraph *m_previous;
+    std::vector<Record<T>> m_records;
+    std::vector<G> m_grad;
+    std::vector<G> m_adjoints;
+};
+
+template <class T, class G = T>
+struct BasicVariable {
+    using Graph = BasicGraph<T, G>;
+
+    Graph *graph;
+    uint32_t index;
+
+    BasicVariable() : BasicVariable(T(0)) {}
+
+    BasicVariable(const T &v) : graph(&Graph::current()), index(graph->leaf(v)) {}  // NOLINT(runtime/explicit)
+
+    BasicVariable(Graph *g, uint32_t i) : graph(g), index(i) {}
+
+    BasicVariable& operator=(const T &v) {
+        *this = BasicVariable(v);
+        return *this;
+    }
+
+    T values() const { return (*graph)[index].value; }
+    G grad() const { return graph->grad(index); }
+
+    void backward() const {
+        const G seed = G(1);
+        graph->backward(&index, &seed, 1);
+    }
+};
+
+namespace detail {
+
+template <class T, class G>
+inline BasicVariable<T, G> unary(OpCode op, const BasicVariable<T, G> &x, T value, T dx, T c = T(0)) {
+    return BasicVariable<T, G>(x.graph, x.graph->push(op, x.index, 0, value, dx, c));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> binary(OpCode op, const BasicVariable<T, G> &l, const BasicVariable<T, G> &r, T value,
+                                  T dl, T dr) {
+    if (l.graph != r.graph) throw std::runtime_error("operands on different graphs");
+    return BasicVariable<T, G>(l.graph, l.graph->push(op, l.index, r.index, value, dl, dr));
+}
+
+}  // namespace detail
+
+template <class T, class G>
+inline BasicVariable<T, G> operator+(const BasicVariable<T, G> &l, const BasicVariable<T, G> &r) {
+    return detail::binary(OpCode::Add, l, r, l.values() + r.values(), T(1), T(1));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator-(const BasicVariable<T, G> &l, const BasicVariable<T, G> &r) {
+    return detail::binary(OpCode::Sub, l, r, l.values() - r.values(), T(1), T(-1));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator*(const BasicVariable<T, G> &l, const BasicVariable<T, G> &r) {
+    return detail::binary(OpCode::Mul, l, r, l.values() * r.values(), r.values(), l.values());
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator/(const BasicVariable<T, G> &l, const BasicVariable<T, G> &r) {
+    T recRight = T(1) / r.values();
+    T value = l.values() / r.values();
+    return detail::binary(OpCode::Div, l, r, value, recRight, -value * recRight);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator+(const BasicVariable<T, G> &l, const detail::Scalar<T> &r) {
+    return detail::unary(OpCode::AddConst, l, l.values() + r, T(1), r);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator+(const detail::Scalar<T> &l, const BasicVariable<T, G> &r) {
+    return detail::unary(OpCode::AddConst, r, l + r.values(), T(1), l);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator-(const BasicVariable<T, G> &l, const detail::Scalar<T> &r) {
+    return detail::unary(OpCode::SubConst, l, l.values() - r, T(1), r);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator-(const detail::Scalar<T> &l, const BasicVariable<T, G> &r) {
+    return detail::unary(OpCode::RSubConst, r, l - r.values(), T(-1), l);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator*(const BasicVariable<T, G> &l, const detail::Scalar<T> &r) {
+    return detail::unary(OpCode::MulConst, l, l.values() * r, r, r);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator*(const detail::Scalar<T> &l, const BasicVariable<T, G> &r) {
+    return detail::unary(OpCode::MulConst, r, l * r.values(), l, l);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator/(const BasicVariable<T, G> &l, const detail::Scalar<T> &r) {
+    return detail::unary(OpCode::DivConst, l, l.values() / r, T(1) / r, r);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator/(const detail::Scalar<T> &l, const BasicVariable<T, G> &r) {
+    T value = l / r.values();
+    return detail::unary(OpCode::RDivConst, r, value, -value / r.values(), l);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator+(const BasicVariable<T, G> &l) {
+    return l;
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> operator-(const BasicVariable<T, G> &l) {
+    return detail::unary(OpCode::Neg, l, -l.values(), T(-1));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> sin(const BasicVariable<T, G> &l) {
+    return detail::unary(OpCode::Sin, l, std::sin(l.values()), std::cos(l.values()));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> cos(const BasicVariable<T, G> &l) {
+    return detail::unary(OpCode::Cos, l, std::cos(l.values()), -std::sin(l.values()));
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> tan(const BasicVariable<T, G> &l) {
+    T value = std::tan(l.values());
+    return detail::unary(OpCode::Tan, l, value, T(1) + value * value);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> exp(const BasicVariable<T, G> &l) {
+    T value = std::exp(l.values());
+    return detail::unary(OpCode::Exp, l, value, value);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> log(const BasicVariable<T, G> &l) {
+    return detail::unary(OpCode::Log, l, std::log(l.values()), T(1) / l.values());
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> sqrt(const BasicVariable<T, G> &l) {
+    T value = std::sqrt(l.values());
+    return detail::unary(OpCode::Sqrt, l, value, T(0.5) / value);
+}
+
+template <class T, class G>
+inline BasicVariable<T, G> abs(const BasicVariable<T, G> &l) {
+    T x = l.values();
+    return detail::unary(OpCode::Abs, l, std::abs(x), x > T(0) ? T(1) : (x < T(0) ? T(-1) : T(0)));
+}
+
+template <class T, class G = T>
+class BasicVector {
+ public:
+    using Graph = BasicGraph<T, G>;
+    using Variable = BasicVariable<T, G>;
+
+    explicit BasicVector(size_t nsize) : m_buffer(nsize) {}
+
+    BasicVector(const std::vector<T> &v) : BasicVector(v.data(), v.size()) {}  // NOLINT(runtime/explicit)
+
+    BasicVector(const T *data, size_t nsize) {
+        m_buffer.reserve(nsize);
+        for (size_t i=0; i < nsize; i++) m_buffer.emplace_back(data[i]);
+    }
+
+    // Leaves on `graph` instead of the current graph.
+    BasicVector(Graph &graph, const T *data, size_t nsize) {
+        m_buffer.reserve(nsize);
+        for (size_t i=0; i < nsize; i++) m_buffer.emplace_back(&graph, graph.leaf(data[i]));
+    }
+
+    size_t size() const { return m_buffer.size(); }
+
+    std::vector<G> grad() const {
+        std::vector<G> res(size());
+        grad(res.data());
+        return res;
+    }
+
+    std::vector<T> values() const {
+        std::vector<T> res(size());
+        values(res.data());
+        return res;
+    }
+
+    void grad(G *out) const {
+        for (size_t i=0; i < size(); i++) out[i] = m_buffer[i].grad();
+    }
+
+    void values(T *out) const {
+        for (size_t i=0; i < size(); i++) out[i] = m_buffer[i].values();
+    }
+
+    void backward() {
+        backward(std::vector<G>(size(), G(1)));
+    }
+
+    // Vector-Jacobian product: adds seed^T J into the leaves' grad.
+    void backward(const std::vector<G> &seed) {
+        if (seed.size() != size()) throw std::runtime_error("seed size not same");
+        if (!size()) return;
+        std::vector<uint32_t> roots(size());
+        for (size_t i=0; i < size(); i++) roots[i] = m_buffer[i].index;
+        graph()->backward(roots.data(), seed.data(), size());
+    }
+
+    // Sets the grad of every element back to zero.
+    void zero_grad() {
+        for (const Variable &x : m_buffer) x.graph->grad(x.index) = G(0);
+    }
+
+    // Overwrites the values of leaf elements in place; forward() on a
+    // retained result built from them picks the new values up.
+    void set_values(const T *data) {
+        for (size_t i=0; i < size(); i++) {
+            const Variable &x = m_buffer[i];
+            if ((*x.graph)[x.index].op != OpCode::Variable) throw std::runtime_error("set_values needs leaves");
+            x.graph->value(x.index) = data[i];
+        }
+    }
+
+    void set_values(const std::vector<T> &v) {
+        if (v.size() != size()) throw std::runtime_error("size not same");
+        set_values(v.data());
+    }
+
+    // Retain mode, as for the node Vector. The records are kept anyway, so
+    // this only marks the Vector; forward() replays the graph's records up to
+    // the newest element. Replacing an element through setitem ends it.
+    void retain(bool on = true) { m_retained = on; }
+
+    bool retained() const { return m_retained; }
+
+    void forward() {
+        if (!m_retained) throw std::runtime_error("forward needs retain()");
+        if (!size()) return;
+        uint32_t top = 0;
+        for (const Variable &x : m_buffer) top = std::max(top, x.index);
+        graph()->evaluate(size_t(top) + 1);
+    }
+
+    T getitem(int index) {
+        if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
+        return m_buffer[index].values();
+    }
+
+    void setitem(int index, T value) {
+        if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
+        Graph *g = graph();
+        m_buffer[index] = Variable(g, g->leaf(value));
+        m_retained = false;
+    }
+
+    std::string info() {
+        std::string res;
+        res += "[ ";
+        for (size_t i=0; i < size(); i++) {
+            res += std::to_string(m_buffer[i].values());
+            res += " ";
+        }
+        res += "]";
+        return res;
+    }
+
+    Variable   operator() (size_t index) const { return m_buffer[index]; }
+    Variable & operator() (size_t index)       { return m_buffer[index]; }
+
+    Variable   operator[] (size_t index) const { return m_buffer[index]; }
+    Variable & operator[] (size_t index)       { return m_buffer[index]; }
+
+    BasicVector operator+(const BasicVector &r) const {
+        return zip(r, [](const Variable &x, const Variable &y) { return x + y; });
+    }
+    BasicVector operator-(const BasicVector &r) const {
+        return zip(r, [](const Variable &x, const Variable &y) { return x - y; });
+    }
+    BasicVector operator*(const BasicVector &r) const {
+        return zip(r, [](const Variable &x, const Variable &y) { return x * y; });
+    }
+    BasicVector operator/(const BasicVector &r) const {
+        return zip(r, [](const Variable &x, const Variable &y) { return x / y; });
+    }
+
+    BasicVector operator+(const T &r) const { return map([&](const Variable &x) { return x + r; }); }
+    BasicVector operator-(const T &r) const { return map([&](const Variable &x) { return x - r; }); }
+    BasicVector operator*(const T &r) const { return map([&](const Variable &x) { return x * r; }); }
+    BasicVector operator/(const T &r) const { return map([&](const Variable &x) { return x / r; }); }
+
+    friend BasicVector operator+(T l, const BasicVector &r) {
+        return r.map([&](const Variable &x) { return l + x; });
+    }
+    friend BasicVector operator-(T l, const BasicVector &r) {
+        return r.map([&](const Variable &x) { return l - x; });
+    }
+    friend BasicVector operator*(T l, const BasicVector &r) {
+        return r.map([&](const Variable &x) { return l * x; });
+    }
+    friend BasicVector operator/(T l, const BasicVector &r) {
+        return r.map([&](const Variable &x) { return l / x; });
+    }
+
+    BasicVector sin() const { return map([](const Variable &x) { return flat::sin(x); }); }
+    BasicVector cos() const { return map([](const Variable &x) { return flat::cos(x); }); }
+    BasicVector tan() const { return map([](const Variable &x) { return flat::tan(x); }); }
+    BasicVector exp() const { return map([](const Variable &x) { return flat::exp(x); }); }
+    BasicVector log() const { return map([](const Variable &x) { return flat::log(x); }); }
+    BasicVector sqrt() const { return map([](const Variable &x) { return flat::sqrt(x); }); }
+    BasicVector abs() const { return map([](const Variable &x) { return flat::abs(x); }); }
+
+ private:
+    BasicVector() {}
+
+    Graph *graph() const {
+        Graph *res = m_buffer[0].graph;
+        for (const Variable &x : m_buffer) {
+            if (x.graph != res) throw std::runtime_error("elements on different graphs");
+        }
+        return res;
+    }
+
+    template <class F>
+    BasicVector map(const F &f) const {
+        BasicVector res;
+        res.m_buffer.reserve(size());
+        for (const Variable &x : m_buffer) res.m_buffer.push_back(f(x));
+        return res;
+    }
+
+    template <class F>
+    BasicVector zip(const BasicVector &r, const F &f) const {
+        if (r.size() != size()) throw std::runtime_error("size not same");
+        BasicVector res;
+        res.m_buffer.reserve(size());
+        for (size_t i=0; i < size(); i++) res.m_buffer.push_back(f(m_buffer[i], r.m_buffer[i]));
+        return res;
+    }
+
+    std::vector<Variable> m_buffer;
+    bool m_retained = false;
+};
+
+using Graph = BasicGraph<double>;
+using Variable = BasicVariable<double>;
+using Vector = BasicVector<double>;
+
+using Graph32 = BasicGraph<float>;
+using Variable32 = BasicVariable<float>;
+using Vector32 = BasicVector<float>;
+
+using MixedGraph = BasicGraph<float, double>;
+using MixedVariable = BasicVariable<float, double>;
+using MixedVector = BasicVector<float, double>;
+
+}  // namespace flat
+}  // namespace autodiff
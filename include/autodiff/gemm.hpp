@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <autodiff/thread_pool.hpp>
+
+namespace autodiff {
+namespace kernels {
+
+namespace detail {
+
+// Block sizes: a packed kc x nc panel of B (256 KiB) stays in L2 and a
+// packed mc x kc block of A (64 KiB) in L1 or close to it; mr x nr is the
+// tile of C a micro-kernel call keeps in registers across the whole kc loop.
+constexpr size_t gemm_mc = 64;
+constexpr size_t gemm_kc = 128;
+constexpr size_t gemm_nc = 256;
+constexpr size_t gemm_mr = 4;
+constexpr size_t gemm_nr = 4;
+
+// Element (i, j) of op(x), where x is stored row-major as op(x) or, when
+// transposed, as its transpose; ld is the stored row length.
+inline double at(const double *x, bool trans, size_t ld, size_t i, size_t j) {
+    return trans ? x[j * ld + i] : x[i * ld + j];
+}
+
+// Two doubles as one GCC/Clang vector, the width every x86-64 target has.
+typedef double double2 __attribute__((vector_size(16)));
+
+// c[0..mr)[0..nr) += a * b over kc, with a packed as kc columns of mr values
+// and b as kc rows of nr values. The mr x nr accumulators are held as vectors
+// for the whole kc loop; only the top-left rows x cols of the tile are
+// stored, for tiles on the edge of C.
+inline void micro(size_t kc, const double *__restrict a, const double *__restrict b, double *c, size_t ldc,
+                  size_t rows, size_t cols) {
+    static_assert(gemm_mr == 4 && gemm_nr == 4, "micro-kernel is written for 4 x 4 tiles");
+    // Spelled out: -O2 does not unroll loops, and indexed accumulators would
+    // live in memory instead of registers.
+    double2 c00 = {}, c01 = {}, c10 = {}, c11 = {}, c20 = {}, c21 = {}, c30 = {}, c31 = {};
+    for (size_t p=0; p < kc; p++) {
+        double2 b0, b1;
+        std::memcpy(&b0, b + p * gemm_nr, sizeof(b0));
+        std::memcpy(&b1, b + p * gemm_nr + 2, sizeof(b1));
+        const double *ap = a + p * gemm_mr;
+        c00 += ap[0] * b0;
+        c01 += ap[0] * b1;
+        c10 += ap[1] * b0;
+        c11 += ap[1] * b1;
+        c20 += ap[2] * b0;
+        c21 += ap[2] * b1;
+        c30 += ap[3] * b0;
+        c31 += ap[3] * b1;
+    }
+    const double2 acc[gemm_mr][2] = { { c00, c01 }, { c10, c11 }, { c20, c21 }, { c30, c31 } };
+    double tile[gemm_mr][gemm_nr];
+    std::memcpy(tile, acc, sizeof(tile));
+    for (size_t r=0; r < rows; r++) {
+        for (size_t j=0; j < cols; j++) c[r * ldc + j] += tile[r][j];
+    }
+}
+
+}  // namespace detail
+
+// c += op(a) * op(b), with op(a) m x k, op(b) k x n and c m x n, all
+// row-major. With ta set a is stored k x m and op(a) is its transpose; the
+// same for tb and b, stored n x k. Transposition is folded into packing, so
+// every combination runs the same micro-kernel.
+//
+// B is packed one kc x nc panel at a time into strips of nr columns; row
+// blocks of A are packed into slivers of mr rows and multiplied into C on
+// the thread pool, each block writing its own rows of C, so results do not
+// depend on the number of threads.
+inline void gemm(bool ta, bool tb, size_t m, size_t n, size_t k, const double *a, const double *b, double *c,
+                 ThreadPool &pool = ThreadPool::instance()) {
+    using detail::gemm_mc;
+    using detail::gemm_kc;
+    using detail::gemm_nc;
+    using detail::gemm_mr;
+    using detail::gemm_nr;
+    if (!m || !n || !k) return;
+    const size_t lda = ta ? m : k, ldb = tb ? k : n;
+    const size_t blocks = (m + gemm_mc - 1) / gemm_mc;
+    // Below about a million multiply-adds the pool costs more than it saves.
+    const bool parallel = blocks > 1 && m * n * k >= (size_t(1) << 20);
+    std::vector<double> bp(gemm_kc * gemm_nc);
+
+    for (size_t jc=0; jc < n; jc += gemm_nc) {
+        const size_t nc = std::min(gemm_nc, n - jc);
+        for (size_t pc=0; pc < k; pc += gemm_kc) {
+            const size_t kc = std::min(gemm_kc, k - pc);
+            for (size_t js=0; js < nc; js += gemm_nr) {
+                double *strip = &bp[js * kc];
+                for (size_t p=0; p < kc; p++) {
+                    for (size_t j=0; j < gemm_nr; j++) {
+                        strip[p * gemm_nr + j] = js + j < nc ? detail::at(b, tb, ldb, pc + p, jc + js + j) : 0.0;
+                    }
+                }
+            }
+
+            auto block = [&](size_t ib) {
+                const size_t ic = ib * gemm_mc, mc = std::min(gemm_mc, m - ic);
+                double ap[gemm_mc * gemm_kc];
+                for (size_t is=0; is < mc; is += gemm_mr) {
+                    double *sliver = &ap[is * kc];
+                    for (size_t p=0; p < kc; p++) {
+                        for (size_t r=0; r < gemm_mr; r++) {
+                            sliver[p * gemm_mr + r] = is + r < mc ? detail::at(a, ta, lda, ic + is + r, pc + p) : 0.0;
+                        }
+                    }
+                }
+                for (size_t is=0; is < mc; is += gemm_mr) {
+                    for (size_t js=0; js < nc; js += gemm_nr) {
+                        detail::micro(kc, &ap[is * kc], &bp[js * kc], c + (ic + is) * n + jc + js, n,
+                                      std::min(gemm_mr, mc - is), std::min(gemm_nr, nc - js));
+                    }
+                }
+            };
+            if (parallel) {
+                pool.parallel_for(blocks, block);
+            } else {
+                for (size_t ib=0; ib < blocks; ib++) block(ib);
+            }
+        }
+    }
+}
+
+}  // namespace kernels
+}  // namespace autodiff
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <autodiff/node.hpp>
+#include <autodiff/tape.hpp>
+#include <autodiff/vector.hpp>
+
+namespace autodiff {
+
+// Hessian-vector products by forward-over-reverse on a recorded tape. A
+// forward sweep carries the tangent of every node along the direction, then
+// the reverse sweep carries each adjoint together with its tangent:
+//
+//     adj[k]  += p_k * adj[i]
+//     dadj[k] += dp_k * adj[i] + p_k * dadj[i]
+//
+// where p_k are the node's partials and dp_k their partial_tangents(). The
+// tangents of the inputs' adjoints are then H v. One product costs about
+// three gradient sweeps; the tape is recorded once and reused.
+class HessianTape {
+ public:
+    // Hessian of sum_k seeds[k] * outputs[k] with respect to the leaves `inputs`.
+    HessianTape(const std::vector<Node *> &outputs, const std::vector<Node *> &inputs,
+                const std::vector<double> &seeds)
+      : m_tape(outputs), m_seeds(seeds) {
+        if (seeds.size() != outputs.size()) throw std::runtime_error("seed size not same");
+        for (const Node *input : inputs) {
+            if (input->arity()) throw std::runtime_error("hessian inputs must be leaves");
+            m_columns.push_back(m_tape.index(input));
+        }
+
+        const size_t n = m_tape.size();
+        m_offsets.assign(n + 1, 0);
+        for (size_t i=0; i < n; i++) {
+            if (m_tape.node(i)->opcode() == OpCode::Fused || m_tape.node(i)->opcode() == OpCode::Checkpoint) {
+                throw std::runtime_error("fused and checkpoint nodes have no second derivatives");
+            }
+            m_offsets[i + 1] = m_offsets[i] + m_tape.arity(i);
+        }
+        m_partials.resize(m_offsets[n]);
+        for (size_t i=0; i < n; i++) m_tape.node(i)->partials(&m_partials[m_offsets[i]]);
+
+        m_tangents.resize(n);
+        m_adjoints.resize(n);
+        m_adjointTangents.resize(n);
+        m_dx.resize(m_offsets[n]);
+        m_dp.resize(m_offsets[n]);
+    }
+
+    size_t inputs() const { return m_columns.size(); }
+
+    // Writes H v to out; v and out hold inputs() values.
+    void product(const double *v, double *out) {
+        const size_t n = m_tape.size();
+        std::fill(m_tangents.begin(), m_tangents.end(), 0.0);
+        for (size_t j=0; j < m_columns.size(); j++) {
+            if (m_columns[j] < n) m_tangents[m_columns[j]] += v[j];
+        }
+        for (size_t i=0; i < n; i++) {
+            if (!m_tape.arity(i)) continue;
+            double t = 0.0;
+            for (size_t k=0; k < m_tape.arity(i); k++) {
+                m_dx[m_offsets[i] + k] = m_tangents[m_tape.operand(i, k)];
+                t += m_partials[m_offsets[i] + k] * m_dx[m_offsets[i] + k];
+            }
+            m_tangents[i] = t;
+        }
+
+        std::fill(m_adjoints.begin(), m_adjoints.end(), 0.0);
+        std::fill(m_adjointTangents.begin(), m_adjointTangents.end(), 0.0);
+        for (size_t r=0; r < m_seeds.size(); r++) m_adjoints[m_tape.root(r)] += m_seeds[r];
+        for (size_t i=n; i-- > 0;) {
+            const double adjoint = m_adjoints[i], adjointTangent = m_adjointTangents[i];
+            if (!m_tape.arity(i) || (adjoint == 0.0 && adjointTangent == 0.0)) continue;
+            const double *p = &m_partials[m_offsets[i]];
+            double *dp = &m_dp[m_offsets[i]];
+            m_tape.node(i)->partial_tangents(&m_dx[m_offsets[i]], dp);
+            for (size_t k=0; k < m_tape.arity(i); k++) {
+                size_t o = m_tape.operand(i, k);
+                m_adjoints[o] += p[k] * adjoint;
+                m_adjointTangents[o] += dp[k] * adjoint + p[k] * adjointTangent;
+            }
+        }
+
+        for (size_t j=0; j < m_columns.size(); j++) {
+            out[j] = m_columns[j] < n ? m_adjointTangents[m_columns[j]] : 0.0;
+        }
+    }
+
+    std::vector<double> product(const std::vector<double> &v) {
+        if (v.size() != inputs()) throw std::runtime_error("size not same");
+        std::vector<double> res(inputs());
+        product(v.data(), res.data());
+        return res;
+    }
+
+    // Dense Hessian, row-major, from one product per unit direction.
+    std::vector<double> dense() {
+        const size_t m = inputs();
+        std::vector<double> res(m * m), e(m, 0.0);
+        for (size_t j=0; j < m; j++) {
+            e[j] = 1.0;
+            product(e.data(), &res[j * m]);
+            e[j] = 0.0;
+        }
+        return res;
+    }
+
+ private:
+    Tape m_tape;
+    std::vector<double> m_seeds;
+    std::vector<size_t> m_columns;
+    std::vector<size_t> m_offsets;
+    std::vector<double> m_partials;
+    std::vector<double> m_dx;
+    std::vector<double> m_dp;
+    std::vector<double> m_tangents;
+    std::vector<double> m_adjoints;
+    std::vector<double> m_adjointTangents;
+};
+
+// H v for the sum of `output`'s elements with respect to `inputs`.
+inline std::vector<double> hvp(const Vector &output, const Vector &inputs, const std::vector<double> &v) {
+    HessianTape tape(output.roots(), inputs.roots(), std::vector<double>(output.size(), 1.0));
+    return tape.product(v);
+}
+
+// Dense Hessian of the sum of `output`'s elements, row-major; for small inputs.
+inline std::vector<double> hessian(const Vector &output, const Vector &inputs) {
+    HessianTape tape(output.roots(), inputs.roots(), std::vector<double>(output.size(), 1.0));
+    return tape.dense();
+}
+
+}  // namespace autodiff
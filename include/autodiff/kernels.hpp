@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <autodiff/vmath.hpp>
+
+// Elementwise loops over contiguous buffers. Each one is a single pass with
+// non-aliasing operands so the compiler emits packed SIMD for the arithmetic;
+// the backward kernels accumulate into `out` and are called once per operand,
+// which keeps them correct when both operands of a node are the same tensor.
+// sin, cos, exp, log and sqrt go through the vectorized vmath kernels.
+namespace autodiff {
+namespace kernels {
+
+inline void add(size_t n, const double *__restrict a, const double *__restrict b, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+inline void sub(size_t n, const double *__restrict a, const double *__restrict b, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = a[i] - b[i];
+}
+
+inline void mul(size_t n, const double *__restrict a, const double *__restrict b, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+inline void div(size_t n, const double *__restrict a, const double *__restrict b, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = a[i] / b[i];
+}
+
+// out = scale * x + shift
+inline void affine(size_t n, const double *__restrict x, double scale, double shift, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = scale * x[i] + shift;
+}
+
+// out = c / x
+inline void recip(size_t n, double c, const double *__restrict x, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = c / x[i];
+}
+
+inline void sin(size_t n, const double *__restrict x, double *__restrict out) {
+    vmath::sin(n, x, out);
+}
+
+inline void cos(size_t n, const double *__restrict x, double *__restrict out) {
+    vmath::cos(n, x, out);
+}
+
+inline void tan(size_t n, const double *__restrict x, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = std::tan(x[i]);
+}
+
+inline void exp(size_t n, const double *__restrict x, double *__restrict out) {
+    vmath::exp(n, x, out);
+}
+
+inline void log(size_t n, const double *__restrict x, double *__restrict out) {
+    vmath::log(n, x, out);
+}
+
+inline void sqrt(size_t n, const double *__restrict x, double *__restrict out) {
+    vmath::sqrt(n, x, out);
+}
+
+inline void abs(size_t n, const double *__restrict x, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] = std::abs(x[i]);
+}
+
+// out += scale * g
+inline void accumulate(size_t n, double scale, const double *__restrict g, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += scale * g[i];
+}
+
+// out += g * x
+inline void accumulate_mul(size_t n, const double *__restrict g, const double *__restrict x,
+                           double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += g[i] * x[i];
+}
+
+// out += g / x
+inline void accumulate_div(size_t n, const double *__restrict g, const double *__restrict x,
+                           double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += g[i] / x[i];
+}
+
+// out -= g * y / x, the pullback of y = a / x (and of y = c / x) into x
+inline void accumulate_quotient(size_t n, const double *__restrict g, const double *__restrict y,
+                                const double *__restrict x, double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] -= g[i] * y[i] / x[i];
+}
+
+inline void sin_backward(size_t n, const double *__restrict g, const double *__restrict x,
+                         double *__restrict out) {
+    double c[vmath::block];
+    for (size_t first=0; first < n; first += vmath::block) {
+        const size_t m = std::min(vmath::block, n - first);
+        vmath::cos(m, x + first, c);
+        for (size_t i=0; i < m; i++) out[first + i] += g[first + i] * c[i];
+    }
+}
+
+inline void cos_backward(size_t n, const double *__restrict g, const double *__restrict x,
+                         double *__restrict out) {
+    double s[vmath::block];
+    for (size_t first=0; first < n; first += vmath::block) {
+        const size_t m = std::min(vmath::block, n - first);
+        vmath::sin(m, x + first, s);
+        for (size_t i=0; i < m; i++) out[first + i] -= g[first + i] * s[i];
+    }
+}
+
+// d tan(x) = 1 + tan(x)^2, taken from the forward result y
+inline void tan_backward(size_t n, const double *__restrict g, const double *__restrict y,
+                         double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += g[i] * (1.0 + y[i] * y[i]);
+}
+
+// d sqrt(x) = 0.5 / sqrt(x), taken from the forward result y
+inline void sqrt_backward(size_t n, const double *__restrict g, const double *__restrict y,
+                          double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += 0.5 * g[i] / y[i];
+}
+
+inline void abs_backward(size_t n, const double *__restrict g, const double *__restrict x,
+                         double *__restrict out) {
+    for (size_t i=0; i < n; i++) out[i] += x[i] > 0.0 ? g[i] : (x[i] < 0.0 ? -g[i] : 0.0);
+}
+
+}  // namespace kernels
+}  // namespace autodiff
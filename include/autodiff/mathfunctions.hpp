@@ -2,36 +2,40 @@
 
 #include <cmath>
 #include <memory>
+#include <autodiff/arena.hpp>
 #include <autodiff/node.hpp>
 
 namespace autodiff {
 
 std::shared_ptr<Node> sin(const std::shared_ptr<Node> &l) {
-    return std::make_shared<SinOpNode>(std::sin(l->value), l);
+    // Adjacent sin and cos of one argument compile to a single sincos call.
+    double s = std::sin(l->value), c = std::cos(l->value);
+    return make_node<SinOpNode>(s, l, c);
 }
 
 std::shared_ptr<Node> cos(const std::shared_ptr<Node> &l) {
-    return std::make_shared<CosOpNode>(std::cos(l->value), l);
+    double s = std::sin(l->value), c = std::cos(l->value);
+    return make_node<CosOpNode>(c, l, -s);
 }
 
 std::shared_ptr<Node> tan(const std::shared_ptr<Node> &l) {
-    return std::make_shared<TanOpNode>(std::tan(l->value), l);
+    return make_node<TanOpNode>(std::tan(l->value), l);
 }
 
 std::shared_ptr<Node> exp(const std::shared_ptr<Node> &l) {
-    return std::make_shared<ExpOpNode>(std::exp(l->value), l);
+    return make_node<ExpOpNode>(std::exp(l->value), l);
 }
 
 std::shared_ptr<Node> log(const std::shared_ptr<Node> &l) {
-    return std::make_shared<LogOpNode>(std::log(l->value), l);
+    return make_node<LogOpNode>(std::log(l->value), l);
 }
 
 std::shared_ptr<Node> sqrt(const std::shared_ptr<Node> &l) {
-    return std::make_shared<SqrtOpNode>(std::sqrt(l->value), l);
+    return make_node<SqrtOpNode>(std::sqrt(l->value), l);
 }
 
 std::shared_ptr<Node> abs(const std::shared_ptr<Node> &l) {
-    return std::make_shared<AbsOpNode>(std::abs(l->value), l);
+    return make_node<AbsOpNode>(std::abs(l->value), l);
 }
 
 std::shared_ptr<Node> sin(const Variable &l) {
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <autodiff/gemm.hpp>
+#include <autodiff/tensor.hpp>
+
+namespace autodiff {
+
+// op(left) * op(right) as one node, op(x) being x or its transpose. The
+// backward pass is two more GEMMs into the operands' stored layout:
+// d op(left) = grad * op(right)^T and d op(right) = op(left)^T * grad.
+struct MatMulTensorNode: TensorNode {
+    std::shared_ptr<TensorNode> left, right;
+    size_t m, n, k;
+    bool ta, tb;
+
+    MatMulTensorNode(const std::shared_ptr<TensorNode> &l, bool ta,
+        const std::shared_ptr<TensorNode> &r, bool tb,
+        size_t m, size_t n, size_t k) :
+        TensorNode(m * n),
+        left(l),
+        right(r),
+        m(m), n(n), k(k),
+        ta(ta), tb(tb) {
+        kernels::gemm(ta, tb, m, n, k, left->value.data(), right->value.data(), value.data());
+    }
+
+    size_t arity() const override { return 2; }
+    TensorNode *operand(size_t i) const override { return i == 0 ? left.get() : right.get(); }
+
+    void backprop() override{
+        if (ta) {
+            kernels::gemm(tb, true, k, m, n, right->value.data(), grad.data(), left->grad.data());
+        } else {
+            kernels::gemm(false, !tb, m, k, n, grad.data(), right->value.data(), left->grad.data());
+        }
+        if (tb) {
+            kernels::gemm(true, ta, n, k, m, grad.data(), left->value.data(), right->grad.data());
+        } else {
+            kernels::gemm(!ta, false, k, n, m, left->value.data(), grad.data(), right->grad.data());
+        }
+    }
+};
+
+// Row-major copy of the transpose of a rows x cols operand.
+struct TransposeTensorNode: UnaryTensorNode {
+    size_t rows, cols;
+
+    TransposeTensorNode(const std::shared_ptr<TensorNode> &m, size_t rows, size_t cols) :
+        UnaryTensorNode(m),
+        rows(rows),
+        cols(cols) {
+        for (size_t i=0; i < rows; i++) {
+            for (size_t j=0; j < cols; j++) value[j * rows + i] = m->value[i * cols + j];
+        }
+    }
+
+    void backprop() override{
+        for (size_t i=0; i < rows; i++) {
+            for (size_t j=0; j < cols; j++) m->grad[i * cols + j] += grad[j * rows + i];
+        }
+    }
+};
+
+// Dense rows x cols matrix on the Tensor graph, stored row-major in one
+// TensorNode. t() is a view: it flips a flag instead of copying, and
+// matmul() hands the flag to the GEMM. Elementwise ops on a transposed view
+// copy it into row-major order first.
+class Matrix {
+ public:
+    Matrix(size_t rows, size_t cols)
+      : m_data(rows * cols), m_rows(rows), m_cols(cols) {}
+
+    Matrix(const double *data, size_t rows, size_t cols)
+      : m_data(data, rows * cols), m_rows(rows), m_cols(cols) {}
+
+    Matrix(const std::vector<double> &v, size_t rows, size_t cols)
+      : m_data(v), m_rows(rows), m_cols(cols) {
+        if (v.size() != rows * cols) throw std::runtime_error("size not same");
+    }
+
+    // Views a Tensor of rows * cols elements as a row-major matrix.
+    Matrix(const Tensor &t, size_t rows, size_t cols)
+      : m_data(t), m_rows(rows), m_cols(cols) {
+        if (t.size() != rows * cols) throw std::runtime_error("size not same");
+    }
+
+    size_t rows() const { return m_rows; }
+    size_t cols() const { return m_cols; }
+    size_t size() const { return m_rows * m_cols; }
+    bool transposed() const { return m_transposed; }
+
+    Matrix t() const {
+        Matrix res = *this;
+        std::swap(res.m_rows, res.m_cols);
+        res.m_transposed = !m_transposed;
+        return res;
+    }
+
+    double get(size_t i, size_t j) const {
+        if (i >= m_rows || j >= m_cols) throw std::runtime_error("index out of range");
+        return m_data.data()[offset(i, j)];
+    }
+
+    // Row-major values and gradient of the matrix as seen, views included.
+    std::vector<double> values() const { return logical(m_data.values()); }
+    std::vector<double> grad() const { return logical(m_data.grad()); }
+
+    // Elements in row-major order, as the underlying Tensor or a copy for a
+    // transposed view.
+    Tensor tensor() const {
+        if (!m_transposed) return m_data;
+        return Tensor(std::make_shared<TransposeTensorNode>(m_data.node(), m_cols, m_rows));
+    }
+
+    // Backward pass seeded with ones on every element.
+    void backward() { tensor().backward(); }
+
+    std::string info() const {
+        std::string res = "[";
+        for (size_t i=0; i < m_rows; i++) {
+            res += i ? "\n [ " : "[ ";
+            for (size_t j=0; j < m_cols; j++) {
+                res += std::to_string(get(i, j));
+                res += " ";
+            }
+            res += "]";
+        }
+        res += "]";
+        return res;
+    }
+
+    Matrix operator+(const Matrix &r) const { return elementwise(r, tensor() + r.tensor()); }
+    Matrix operator-(const Matrix &r) const { return elementwise(r, tensor() - r.tensor()); }
+    // Elementwise (Hadamard) product; matmul() is the matrix product.
+    Matrix operator*(const Matrix &r) const { return elementwise(r, tensor() * r.tensor()); }
+    Matrix operator/(const Matrix &r) const { return elementwise(r, tensor() / r.tensor()); }
+
+    Matrix operator+(const double &r) const { return Matrix(tensor() + r, m_rows, m_cols); }
+    Matrix operator-(const double &r) const { return Matrix(tensor() - r, m_rows, m_cols); }
+    Matrix operator*(const double &r) const { return Matrix(tensor() * r, m_rows, m_cols); }
+    Matrix operator/(const double &r) const { return Matrix(tensor() / r, m_rows, m_cols); }
+
+    friend Matrix matmul(const Matrix &a, const Matrix &b);
+    friend Tensor matvec(const Matrix &a, const Tensor &x);
+
+ private:
+    size_t offset(size_t i, size_t j) const { return m_transposed ? j * m_rows + i : i * m_cols + j; }
+
+    std::vector<double> logical(const std::vector<double> &stored) const {
+        if (!m_transposed) return stored;
+        std::vector<double> res(size());
+        for (size_t i=0; i < m_rows; i++) {
+            for (size_t j=0; j < m_cols; j++) res[i * m_cols + j] = stored[offset(i, j)];
+        }
+        return res;
+    }
+
+    Matrix elementwise(const Matrix &r, const Tensor &res) const {
+        if (r.m_rows != m_rows || r.m_cols != m_cols) throw std::runtime_error("shape not same");
+        return Matrix(res, m_rows, m_cols);
+    }
+
+    Tensor m_data;
+    size_t m_rows, m_cols;
+    bool m_transposed = false;
+};
+
+// Matrix product a * b by blocked, multithreaded GEMM; transposed views are
+// read in place.
+inline Matrix matmul(const Matrix &a, const Matrix &b) {
+    if (a.m_cols != b.m_rows) throw std::runtime_error("inner dimensions not same");
+    auto node = std::make_shared<MatMulTensorNode>(a.m_data.node(), a.m_transposed, b.m_data.node(), b.m_transposed,
+                                                   a.m_rows, b.m_cols, a.m_cols);
+    return Matrix(Tensor(node), a.m_rows, b.m_cols);
+}
+
+// a * x for a Tensor x of a.cols() elements, as a GEMM with one column.
+inline Tensor matvec(const Matrix &a, const Tensor &x) {
+    if (a.m_cols != x.size()) throw std::runtime_error("inner dimensions not same");
+    return Tensor(std::make_shared<MatMulTensorNode>(a.m_data.node(), a.m_transposed, x.node(), false,
+                                                     a.m_rows, 1, a.m_cols));
+}
+
+}  // namespace autodiff
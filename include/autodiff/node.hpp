@@ -1,23 +1,119 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <cmath>
+#include <utility>
+#include <vector>
 
 namespace autodiff {
 
+// Monotonic creation counter. Operands are always created before the nodes
+// consuming them, so sorting by it yields a topological order of any graph.
+inline uint64_t next_node_order() {
+    static std::atomic<uint64_t> counter{0};
+    return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Kind of a node, for profiling and for replaying a recorded graph.
+enum class OpCode {
+    Constant, Variable, Copy, Add, Sub, Mul, Div, Neg, Sin, Cos, Tan, Exp, Log, Sqrt, Abs, Fused,
+    AddConst, SubConst, RSubConst, MulConst, DivConst, RDivConst, Checkpoint,
+    Sum, Mean, Dot, Norm, Count
+};
+
+inline const char *opcode_name(OpCode op) {
+    static const char *names[] = {
+        "constant", "variable", "copy", "add", "sub", "mul", "div", "neg",
+        "sin", "cos", "tan", "exp", "log", "sqrt", "abs", "fused",
+        "add_const", "sub_const", "rsub_const", "mul_const", "div_const", "rdiv_const", "checkpoint",
+        "sum", "mean", "dot", "norm2"
+    };
+    return names[static_cast<size_t>(op)];
+}
+
 struct Node {
     double value;
+    const uint64_t order;
 
-    explicit Node(const double &v): value(v) {}
-    ~Node() {}
+    explicit Node(const double &v): value(v), order(next_node_order()) {}
+    virtual ~Node() {}
     virtual double getGradient() { return 0.0; }
     virtual void setGradient(const double &) {}
-    virtual void prop(const double &output) = 0;
+
+    virtual OpCode opcode() const { return OpCode::Constant; }
+
+    // Graph structure used by the tape to order the backward sweep.
+    virtual size_t arity() const { return 0; }
+    virtual Node *operand(size_t /*i*/) const { return nullptr; }
+
+    // Writes d(value)/d(operand(i)) to out[i] for every operand.
+    virtual void partials(double * /*out*/) const {}
+
+    // Writes the derivative of each partial along the operands' tangents dx,
+    // i.e. out[i] = sum_j d2(value)/d(operand i)d(operand j) * dx[j], for
+    // second-order sweeps. Zero unless the op is nonlinear.
+    virtual void partial_tangents(const double * /*dx*/, double *out) const {
+        for (size_t i=0; i < arity(); i++) out[i] = 0.0;
+    }
+
+    // Backward hook for nodes whose partials depend on their own adjoint,
+    // such as checkpointed segments (OpCode::Checkpoint only). Single-lane
+    // sweeps call it with the node's total adjoint right before partials()
+    // and scale the partials by the returned value instead.
+    virtual double receive(const double &adjoint) { return adjoint; }
+
+    // Receives the total adjoint of this node once per backward sweep.
+    virtual void accumulate(const double & /*adjoint*/) {}
+
+    // Recomputes value from the operands' current values, for replaying a
+    // retained graph after its leaves changed. Leaves keep their value.
+    virtual void evaluate() {}
+
+    // Moves the operands this node is the last owner of into out, for
+    // detail::release_operands.
+    virtual void detach(std::vector<std::shared_ptr<Node>> & /*out*/) {}
+
+    // Runs a backward sweep seeded with `output` at this node; defined in tape.hpp.
+    void prop(const double &output);
 };
 
+namespace detail {
+
+template <class T>
+void detach_unique(std::shared_ptr<T> &operand, std::vector<std::shared_ptr<Node>> &out) {
+    if (operand && operand.use_count() == 1) out.push_back(std::move(operand));
+}
+
+// Called from the destructor of every node type that owns operands. Freeing
+// a node frees the operands it last owned, which would recurse once per node
+// down a long chain and overflow the stack. Instead the outermost release on
+// a thread collects such operands on a work list and frees them one at a
+// time; the releases they trigger in turn only add to that list.
+inline void release_operands(Node &node) {
+    static thread_local std::vector<std::shared_ptr<Node>> *pending = nullptr;
+    if (pending) {
+        node.detach(*pending);
+        return;
+    }
+    std::vector<std::shared_ptr<Node>> stack;
+    node.detach(stack);
+    if (stack.empty()) return;
+    pending = &stack;
+    while (!stack.empty()) {
+        std::shared_ptr<Node> next = std::move(stack.back());
+        stack.pop_back();
+        next.reset();
+    }
+    pending = nullptr;
+}
+
+}  // namespace detail
+
 struct ConstantNode: Node {
     explicit ConstantNode(const double &v) : Node(v) {}
-    void prop(const double & /*output*/) override { /* do nothing */ }
 };
 
 struct VarNode : Node {
@@ -26,13 +122,14 @@ struct VarNode : Node {
     explicit VarNode(const double &v): Node(v), grad(0.0) {}
     virtual double getGradient() { return grad; }
     virtual void setGradient(const double &g) { grad = g; }
+    OpCode opcode() const override { return OpCode::Variable; }
+    void accumulate(const double &adjoint) override{
+        grad += adjoint;
+    }
 };
 
 struct IndVarNode: VarNode {
     explicit IndVarNode(const double &v): VarNode(v) {}
-    void prop(const double &output) override{
-        grad += output;
-    }
 };
 
 struct DepVarNode: VarNode {
@@ -42,10 +139,19 @@ struct DepVarNode: VarNode {
         VarNode(m->value),
         m(m)
         {}
+    ~DepVarNode() { detail::release_operands(*this); }
 
-    void prop(const double &output) override{
-        grad += output;
-        m->prop(output);
+    OpCode opcode() const override { return OpCode::Copy; }
+    void evaluate() override{
+        value = m->value;
+    }
+    size_t arity() const override { return 1; }
+    Node *operand(size_t) const override { return m.get(); }
+    void partials(double *out) const override{
+        out[0] = 1.0;
+    }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override{
+        detail::detach_unique(m, out);
     }
 };
 
@@ -59,6 +165,14 @@ struct BinaryOpNode: Node {
         left(l),
         right(r)
         {}
+    ~BinaryOpNode() { detail::release_operands(*this); }
+
+    size_t arity() const override { return 2; }
+    Node *operand(size_t i) const override { return i == 0 ? left.get() : right.get(); }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override{
+        detail::detach_unique(left, out);
+        detail::detach_unique(right, out);
+    }
 };
 
 struct AddOpNode: BinaryOpNode {
@@ -68,9 +182,13 @@ struct AddOpNode: BinaryOpNode {
         BinaryOpNode(v, l, r)
         {}
 
-    void prop(const double &output) override{
-        left->prop(output);
-        right->prop(output);
+    OpCode opcode() const override { return OpCode::Add; }
+    void evaluate() override{
+        value = left->value + right->value;
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0;
+        out[1] = 1.0;
     }
 };
 
@@ -81,9 +199,13 @@ struct SubOpNode: BinaryOpNode {
         BinaryOpNode(v, l, r)
         {}
 
-    void prop(const double &output) override{
-        left->prop(output);
-        right->prop(-output);
+    OpCode opcode() const override { return OpCode::Sub; }
+    void evaluate() override{
+        value = left->value - right->value;
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0;
+        out[1] = -1.0;
     }
 };
 
@@ -94,9 +216,17 @@ struct MulOpNode: BinaryOpNode {
         BinaryOpNode(v, l, r)
         {}
 
-    void prop(const double &output) override{
-        left->prop(right->value * output);
-        right->prop(left->value * output);
+    OpCode opcode() const override { return OpCode::Mul; }
+    void evaluate() override{
+        value = left->value * right->value;
+    }
+    void partials(double *out) const override{
+        out[0] = right->value;
+        out[1] = left->value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = dx[1];
+        out[1] = dx[0];
     }
 };
 
@@ -107,10 +237,19 @@ struct DivOpNode: BinaryOpNode {
         BinaryOpNode(v, l, r)
         {}
 
-    void prop(const double &output) override{
+    OpCode opcode() const override { return OpCode::Div; }
+    void evaluate() override{
+        value = left->value / right->value;
+    }
+    void partials(double *out) const override{
+        double recRight = 1.0 / right->value;
+        out[0] = recRight;
+        out[1] = recRight * recRight * (-left->value);
+    }
+    void partial_tangents(const double *dx, double *out) const override{
         double recRight = 1.0 / right->value;
-        left->prop(recRight * output);
-        right->prop(recRight * recRight * (-left->value) * output);
+        out[0] = -dx[1] * recRight * recRight;
+        out[1] = (2.0 * left->value * dx[1] * recRight - dx[0]) * recRight * recRight;
     }
 };
 
@@ -122,6 +261,101 @@ struct UnaryOpNode: Node {
         Node(v),
         m(m)
         {}
+    ~UnaryOpNode() { detail::release_operands(*this); }
+
+    size_t arity() const override { return 1; }
+    Node *operand(size_t) const override { return m.get(); }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override{
+        detail::detach_unique(m, out);
+    }
+};
+
+// Op with one node operand and a scalar constant stored inline, so
+// `x * 5.0` costs one node instead of an op and a ConstantNode.
+struct ConstOpNode: UnaryOpNode {
+    double c;
+
+    ConstOpNode(const double &v,
+        const std::shared_ptr<Node> m,
+        const double &c) :
+        UnaryOpNode(v, m),
+        c(c)
+        {}
+};
+
+// x + c
+struct AddConstNode: ConstOpNode {
+    AddConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::AddConst; }
+    void evaluate() override{
+        value = m->value + c;
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0;
+    }
+};
+
+// x - c
+struct SubConstNode: ConstOpNode {
+    SubConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::SubConst; }
+    void evaluate() override{
+        value = m->value - c;
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0;
+    }
+};
+
+// c - x
+struct RSubConstNode: ConstOpNode {
+    RSubConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::RSubConst; }
+    void evaluate() override{
+        value = c - m->value;
+    }
+    void partials(double *out) const override{
+        out[0] = -1.0;
+    }
+};
+
+// x * c
+struct MulConstNode: ConstOpNode {
+    MulConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::MulConst; }
+    void evaluate() override{
+        value = m->value * c;
+    }
+    void partials(double *out) const override{
+        out[0] = c;
+    }
+};
+
+// x / c
+struct DivConstNode: ConstOpNode {
+    DivConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::DivConst; }
+    void evaluate() override{
+        value = m->value / c;
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0 / c;
+    }
+};
+
+// c / x
+struct RDivConstNode: ConstOpNode {
+    RDivConstNode(const double &v, const std::shared_ptr<Node> m, const double &c) : ConstOpNode(v, m, c) {}
+    OpCode opcode() const override { return OpCode::RDivConst; }
+    void evaluate() override{
+        value = c / m->value;
+    }
+    void partials(double *out) const override{
+        out[0] = -value / m->value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = 2.0 * value * dx[0] / (m->value * m->value);
+    }
 };
 
 struct NegOpNode: UnaryOpNode {
@@ -129,28 +363,59 @@ struct NegOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
-        m->prop(-output);
+    OpCode opcode() const override { return OpCode::Neg; }
+    void evaluate() override{
+        value = -m->value;
+    }
+    void partials(double *out) const override{
+        out[0] = -1.0;
     }
 };
 
+// Partials below come from values cached at forward time, so a backward
+// sweep makes no libm calls: sin and cos keep the derivative computed next
+// to the value, the others derive it from their own value.
 struct SinOpNode: UnaryOpNode {
+    double derivative;
+
     SinOpNode(const double &v,
-        const std::shared_ptr<Node> m) :
-        UnaryOpNode(v, m)
+        const std::shared_ptr<Node> m,
+        const double &derivative) :
+        UnaryOpNode(v, m),
+        derivative(derivative)
         {}
-    void prop(const double &output) override{
-        m->prop(std::cos(m->value) * output);
+    OpCode opcode() const override { return OpCode::Sin; }
+    void evaluate() override{
+        value = std::sin(m->value);
+        derivative = std::cos(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = derivative;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = -value * dx[0];
     }
 };
 
 struct CosOpNode: UnaryOpNode {
+    double derivative;
+
     CosOpNode(const double &v,
-        const std::shared_ptr<Node> m) :
-        UnaryOpNode(v, m)
+        const std::shared_ptr<Node> m,
+        const double &derivative) :
+        UnaryOpNode(v, m),
+        derivative(derivative)
         {}
-    void prop(const double &output) override{
-        m->prop(std::sin(m->value) * (-output));
+    OpCode opcode() const override { return OpCode::Cos; }
+    void evaluate() override{
+        value = std::cos(m->value);
+        derivative = -std::sin(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = derivative;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = -value * dx[0];
     }
 };
 
@@ -159,9 +424,15 @@ struct TanOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
-        double secx = 1.0 / std::cos(m->value);
-        m->prop(secx * secx * output);
+    OpCode opcode() const override { return OpCode::Tan; }
+    void evaluate() override{
+        value = std::tan(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0 + value * value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = 2.0 * value * (1.0 + value * value) * dx[0];
     }
 };
 
@@ -170,8 +441,15 @@ struct ExpOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
-        m->prop(std::exp(m->value) * output);
+    OpCode opcode() const override { return OpCode::Exp; }
+    void evaluate() override{
+        value = std::exp(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = value * dx[0];
     }
 };
 
@@ -180,8 +458,15 @@ struct LogOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
-        m->prop(output / m->value);
+    OpCode opcode() const override { return OpCode::Log; }
+    void evaluate() override{
+        value = std::log(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = 1.0 / m->value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = -dx[0] / (m->value * m->value);
     }
 };
 
@@ -190,8 +475,15 @@ struct SqrtOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
-        m->prop(output / (2.0 * std::sqrt(m->value)));
+    OpCode opcode() const override { return OpCode::Sqrt; }
+    void evaluate() override{
+        value = std::sqrt(m->value);
+    }
+    void partials(double *out) const override{
+        out[0] = 0.5 / value;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        out[0] = -0.25 * dx[0] / (value * value * value);
     }
 };
 
@@ -200,15 +492,139 @@ struct AbsOpNode: UnaryOpNode {
         const std::shared_ptr<Node> m) :
         UnaryOpNode(v, m)
         {}
-    void prop(const double &output) override{
+    OpCode opcode() const override { return OpCode::Abs; }
+    void evaluate() override{
+        value = std::abs(m->value);
+    }
+    void partials(double *out) const override{
         if (m->value > 0.0) {
-            m->prop(output);
+            out[0] = 1.0;
         } else if (m->value < 0.0) {
-            m->prop(-output);
+            out[0] = -1.0;
         } else {
-            m->prop(0.0);
+            out[0] = 0.0;
         }
     }
 };
 
+namespace detail {
+
+// Sum of x[0..n) in eight independent lanes, which the compiler keeps in
+// vector registers, over blocks of up to 256 values; longer ranges are
+// halved recursively, so rounding error grows with log n instead of n.
+inline double pairwise_sum(const double *x, size_t n) {
+    if (n > 256) {
+        size_t half = n / 2 / 8 * 8;
+        return pairwise_sum(x, half) + pairwise_sum(x + half, n - half);
+    }
+    double lanes[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t l=0; l < 8; l++) lanes[l] += x[i + l];
+    }
+    double res = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; i < n; i++) res += x[i];
+    return res;
+}
+
+}  // namespace detail
+
+// One node over many operands, so a reduction adds a single entry to the
+// tape and its backward sweep is one pass over the operands. Values are
+// gathered into a contiguous buffer and summed pairwise.
+struct ReductionNode: Node {
+    std::vector<std::shared_ptr<Node>> operands;
+
+    explicit ReductionNode(std::vector<std::shared_ptr<Node>> ops) :
+        Node(0.0),
+        operands(std::move(ops))
+        {}
+    ~ReductionNode() { detail::release_operands(*this); }
+
+    size_t arity() const override { return operands.size(); }
+    Node *operand(size_t i) const override { return operands[i].get(); }
+    void detach(std::vector<std::shared_ptr<Node>> &out) override{
+        for (auto &operand : operands) detail::detach_unique(operand, out);
+    }
+
+ protected:
+    // Pairwise sum of f(i) over i < n.
+    template <class F>
+    double reduce(size_t n, const F &f) const {
+        std::vector<double> terms(n);
+        for (size_t i=0; i < n; i++) terms[i] = f(i);
+        return detail::pairwise_sum(terms.data(), n);
+    }
+};
+
+struct SumNode: ReductionNode {
+    explicit SumNode(std::vector<std::shared_ptr<Node>> ops) : ReductionNode(std::move(ops)) { evaluate(); }
+
+    OpCode opcode() const override { return OpCode::Sum; }
+    void evaluate() override{
+        value = reduce(arity(), [&](size_t i) { return operands[i]->value; });
+    }
+    void partials(double *out) const override{
+        for (size_t i=0; i < arity(); i++) out[i] = 1.0;
+    }
+};
+
+struct MeanNode: ReductionNode {
+    explicit MeanNode(std::vector<std::shared_ptr<Node>> ops) : ReductionNode(std::move(ops)) { evaluate(); }
+
+    OpCode opcode() const override { return OpCode::Mean; }
+    void evaluate() override{
+        value = reduce(arity(), [&](size_t i) { return operands[i]->value; }) / arity();
+    }
+    void partials(double *out) const override{
+        const double w = 1.0 / arity();
+        for (size_t i=0; i < arity(); i++) out[i] = w;
+    }
+};
+
+// Operands are x_0..x_n-1 followed by y_0..y_n-1.
+struct DotNode: ReductionNode {
+    explicit DotNode(std::vector<std::shared_ptr<Node>> ops) : ReductionNode(std::move(ops)) { evaluate(); }
+
+    OpCode opcode() const override { return OpCode::Dot; }
+    void evaluate() override{
+        const size_t n = arity() / 2;
+        value = reduce(n, [&](size_t i) { return operands[i]->value * operands[n + i]->value; });
+    }
+    void partials(double *out) const override{
+        const size_t n = arity() / 2;
+        for (size_t i=0; i < n; i++) {
+            out[i] = operands[n + i]->value;
+            out[n + i] = operands[i]->value;
+        }
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        const size_t n = arity() / 2;
+        for (size_t i=0; i < n; i++) {
+            out[i] = dx[n + i];
+            out[n + i] = dx[i];
+        }
+    }
+};
+
+// Euclidean norm; its partials are taken as 0 at the origin.
+struct NormNode: ReductionNode {
+    explicit NormNode(std::vector<std::shared_ptr<Node>> ops) : ReductionNode(std::move(ops)) { evaluate(); }
+
+    OpCode opcode() const override { return OpCode::Norm; }
+    void evaluate() override{
+        value = std::sqrt(reduce(arity(), [&](size_t i) { return operands[i]->value * operands[i]->value; }));
+    }
+    void partials(double *out) const override{
+        const double r = value > 0.0 ? 1.0 / value : 0.0;
+        for (size_t i=0; i < arity(); i++) out[i] = operands[i]->value * r;
+    }
+    void partial_tangents(const double *dx, double *out) const override{
+        const double r = value > 0.0 ? 1.0 / value : 0.0;
+        double xdx = 0.0;
+        for (size_t i=0; i < arity(); i++) xdx += operands[i]->value * dx[i];
+        for (size_t i=0; i < arity(); i++) out[i] = (dx[i] - operands[i]->value * xdx * r * r) * r;
+    }
+};
+
 }  // namespace autodiff
@@ -1,21 +1,22 @@
 #pragma once
 
 #include <memory>
+#include <autodiff/arena.hpp>
 #include <autodiff/node.hpp>
 #include <autodiff/variable.hpp>
 
 namespace autodiff {
 
 std::shared_ptr<Node> operator+(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<AddOpNode>(l->value + r->value, l, r);
+    return make_node<AddOpNode>(l->value + r->value, l, r);
 }
 
 std::shared_ptr<Node> operator+(const std::shared_ptr<Node> &l, const double &r) {
-    return std::make_shared<AddOpNode>(l->value + r, l, std::make_shared<ConstantNode>(r));
+    return make_node<AddConstNode>(l->value + r, l, r);
 }
 
 std::shared_ptr<Node> operator+(const double &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<AddOpNode>(l + r->value, std::make_shared<ConstantNode>(l), r);
+    return make_node<AddConstNode>(l + r->value, r, l);
 }
 
 std::shared_ptr<Node> operator+(const std::shared_ptr<Node> &l) {
@@ -47,19 +48,19 @@ std::shared_ptr<Node> operator+(const Variable &l, const double &r) {
 }
 
 std::shared_ptr<Node> operator-(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<SubOpNode>(l->value - r->value, l, r);
+    return make_node<SubOpNode>(l->value - r->value, l, r);
 }
 
 std::shared_ptr<Node> operator-(const std::shared_ptr<Node> &l, const double &r) {
-    return std::make_shared<SubOpNode>(l->value - r, l, std::make_shared<ConstantNode>(r));
+    return make_node<SubConstNode>(l->value - r, l, r);
 }
 
 std::shared_ptr<Node> operator-(const double &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<SubOpNode>(l - r->value, std::make_shared<ConstantNode>(l), r);
+    return make_node<RSubConstNode>(l - r->value, r, l);
 }
 
 std::shared_ptr<Node> operator-(const std::shared_ptr<Node> &l) {
-    return std::make_shared<NegOpNode>(-l->value, l);
+    return make_node<NegOpNode>(-l->value, l);
 }
 
 std::shared_ptr<Node> operator-(const Variable &l) {
@@ -87,15 +88,15 @@ std::shared_ptr<Node> operator-(const Variable &l, const double &r) {
 }
 
 std::shared_ptr<Node> operator*(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<MulOpNode>(l->value * r->value, l, r);
+    return make_node<MulOpNode>(l->value * r->value, l, r);
 }
 
 std::shared_ptr<Node> operator*(const std::shared_ptr<Node> &l, const double &r) {
-    return std::make_shared<MulOpNode>(l->value * r, l, std::make_shared<ConstantNode>(r));
+    return make_node<MulConstNode>(l->value * r, l, r);
 }
 
 std::shared_ptr<Node> operator*(const double &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<MulOpNode>(l * r->value, std::make_shared<ConstantNode>(l), r);
+    return make_node<MulConstNode>(l * r->value, r, l);
 }
 
 std::shared_ptr<Node> operator*(const Variable &l, const Variable &r) {
@@ -119,15 +120,15 @@ std::shared_ptr<Node> operator*(const Variable &l, const double &r) {
 }
 
 std::shared_ptr<Node> operator/(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<DivOpNode>(l->value / r->value, l, r);
+    return make_node<DivOpNode>(l->value / r->value, l, r);
 }
 
 std::shared_ptr<Node> operator/(const std::shared_ptr<Node> &l, const double &r) {
-    return std::make_shared<DivOpNode>(l->value / r, l, std::make_shared<ConstantNode>(r));
+    return make_node<DivConstNode>(l->value / r, l, r);
 }
 
 std::shared_ptr<Node> operator/(const double &l, const std::shared_ptr<Node> &r) {
-    return std::make_shared<DivOpNode>(l / r->value, std::make_shared<ConstantNode>(l), r);
+    return make_node<RDivConstNode>(l / r->value, r, l);
 }
 
 std::shared_ptr<Node> operator/(const Variable &l, const Variable &r) {
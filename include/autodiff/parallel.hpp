@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <autodiff/arena.hpp>
+#include <autodiff/node.hpp>
+#include <autodiff/tape.hpp>
+#include <autodiff/thread_pool.hpp>
+
+namespace autodiff {
+
+namespace detail {
+
+inline size_t find_root(std::vector<size_t> &parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+}  // namespace detail
+
+// Loops of at least this many elements are split across the thread pool.
+inline size_t &parallel_threshold() {
+    static size_t threshold = 1 << 14;
+    return threshold;
+}
+
+// Calls body(begin, end) over [0, n), split into one contiguous chunk per pool
+// thread when n reaches parallel_threshold(). Chunks run under a lease on the
+// caller's arena, so nodes built by the body stay in its scope.
+template <class F>
+void parallel_for_range(size_t n, const F &body, ThreadPool &pool = ThreadPool::instance()) {
+    if (n < parallel_threshold() || pool.size() == 1) {
+        body(0, n);
+        return;
+    }
+    GraphArena *arena = GraphArena::current();
+    const size_t chunks = pool.size();
+    pool.parallel_for(chunks, [&](size_t c) {
+        GraphArena::Lease lease(arena);
+        body(n * c / chunks, n * (c + 1) / chunks);
+    });
+}
+
+// Backward sweep over many roots on the thread pool.
+//
+// Deterministic mode records one tape, splits it into connected components
+// and sweeps whole components per thread. No node is shared between threads,
+// so every adjoint is summed in the same order as the serial sweep and the
+// gradients match it bit for bit.
+//
+// Otherwise the roots are split into contiguous chunks, each thread records
+// and sweeps its own tape with its own adjoint buffer, and the buffers are
+// reduced into the shared leaves afterwards. This skips the serial recording
+// but sums shared leaves in a different order. Checkpointed segments keep
+// adjoints in the segment node itself, so chunks reaching one would race;
+// graphs with checkpoints take the deterministic path instead.
+inline void parallel_backward(const std::vector<Node *> &roots, const std::vector<double> &seeds,
+                              bool deterministic = true, ThreadPool &pool = ThreadPool::instance()) {
+    const size_t threads = pool.size();
+    if (threads == 1 || roots.size() < 2) {
+        Tape tape(roots);
+        tape.backward(seeds);
+        return;
+    }
+
+    if (!deterministic) {
+        const size_t chunks = std::min(threads, roots.size());
+        std::vector<Tape> tapes(chunks);
+        pool.parallel_for(chunks, [&](size_t c) {
+            size_t begin = roots.size() * c / chunks;
+            size_t end = roots.size() * (c + 1) / chunks;
+            tapes[c].record(std::vector<Node *>(roots.begin() + begin, roots.begin() + end));
+        });
+        if (std::none_of(tapes.begin(), tapes.end(), [](const Tape &t) { return t.hooked(); })) {
+            pool.parallel_for(chunks, [&](size_t c) {
+                size_t begin = roots.size() * c / chunks;
+                size_t end = roots.size() * (c + 1) / chunks;
+                tapes[c].propagate(std::vector<double>(seeds.begin() + begin, seeds.begin() + end));
+            });
+            for (Tape &tape : tapes) tape.accumulate();
+            return;
+        }
+    }
+
+    Tape tape(roots);
+    tape.seed(seeds);
+
+    const size_t n = tape.size();
+    std::vector<size_t> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    for (size_t i=0; i < n; i++) {
+        for (size_t k=0; k < tape.arity(i); k++) {
+            size_t a = detail::find_root(parent, i);
+            size_t b = detail::find_root(parent, tape.operand(i, k));
+            if (a != b) parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // Components are laid out in order of their first entry and cut into
+    // contiguous, equally sized runs, one per thread.
+    std::vector<size_t> component(n);
+    std::vector<size_t> componentSize;
+    for (size_t i=0; i < n; i++) {
+        size_t r = detail::find_root(parent, i);
+        if (r == i) {
+            component[i] = componentSize.size();
+            componentSize.push_back(0);
+        } else {
+            component[i] = component[r];
+        }
+        componentSize[component[i]]++;
+    }
+
+    std::vector<size_t> bucketOf(componentSize.size());
+    size_t prefix = 0;
+    for (size_t c=0; c < componentSize.size(); c++) {
+        bucketOf[c] = prefix * threads / n;
+        prefix += componentSize[c];
+    }
+
+    std::vector<std::vector<size_t>> buckets(threads);
+    for (size_t i=0; i < n; i++) {
+        buckets[bucketOf[component[i]]].push_back(i);
+    }
+
+    pool.parallel_for(threads, [&](size_t b) {
+        tape.sweep(buckets[b]);
+        tape.accumulate(buckets[b]);
+    });
+}
+
+}  // namespace autodiff
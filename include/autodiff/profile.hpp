@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <autodiff/node.hpp>
+
+namespace autodiff {
+
+// Counters collected when the library is built with -DAUTODIFF_PROFILE.
+// Without it every hook below compiles to nothing and stats() stays zero.
+#ifdef AUTODIFF_PROFILE
+constexpr bool profiling_enabled = true;
+#else
+constexpr bool profiling_enabled = false;
+#endif
+
+enum class Phase { Construct, Record, Sweep, Accumulate, Count };
+
+struct Stats {
+    // Nodes created through make_node, by OpCode.
+    std::array<uint64_t, static_cast<size_t>(OpCode::Count)> nodes{};
+    // Bytes requested for nodes, control blocks included.
+    uint64_t bytes = 0;
+    // Times a node was reached while recording tapes, once per root and once
+    // per operand slot. visited - recorded counts the extra paths into shared
+    // nodes, each of which a per-path traversal would walk again.
+    uint64_t visited = 0;
+    // Distinct nodes put on tapes.
+    uint64_t recorded = 0;
+    // Tape entries pulled through in backward sweeps.
+    uint64_t swept = 0;
+    // Wall time per phase: node allocation and construction, tape recording,
+    // adjoint sweeps and handing adjoints to the leaves.
+    std::array<double, static_cast<size_t>(Phase::Count)> seconds{};
+
+    uint64_t created(OpCode op) const { return nodes[static_cast<size_t>(op)]; }
+    double time(Phase phase) const { return seconds[static_cast<size_t>(phase)]; }
+};
+
+namespace profile {
+
+#ifdef AUTODIFF_PROFILE
+
+struct Counters {
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(OpCode::Count)> nodes{};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> visited{0};
+    std::atomic<uint64_t> recorded{0};
+    std::atomic<uint64_t> swept{0};
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Phase::Count)> nanoseconds{};
+};
+
+inline Counters &counters() {
+    static Counters c;
+    return c;
+}
+
+inline void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void created(const Node &node) { add(counters().nodes[static_cast<size_t>(node.opcode())], 1); }
+inline void allocated(size_t bytes) { add(counters().bytes, bytes); }
+inline void visited(size_t n) { add(counters().visited, n); }
+inline void recorded(size_t n) { add(counters().recorded, n); }
+inline void swept(size_t n) { add(counters().swept, n); }
+
+// Adds the lifetime of the scope to a phase.
+class Timer {
+ public:
+    explicit Timer(Phase phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) {}
+
+    ~Timer() {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        add(counters().nanoseconds[static_cast<size_t>(m_phase)],
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    Timer(const Timer &) = delete;
+    Timer& operator=(const Timer &) = delete;
+
+ private:
+    Phase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#else
+
+inline void created(const Node &) {}
+inline void allocated(size_t) {}
+inline void visited(size_t) {}
+inline void recorded(size_t) {}
+inline void swept(size_t) {}
+
+class Timer {
+ public:
+    explicit Timer(Phase) {}
+};
+
+#endif
+
+}  // namespace profile
+
+// Snapshot of the counters since start-up or the last reset_stats().
+inline Stats stats() {
+    Stats s;
+#ifdef AUTODIFF_PROFILE
+    profile::Counters &c = profile::counters();
+    for (size_t i=0; i < s.nodes.size(); i++) s.nodes[i] = c.nodes[i].load();
+    s.bytes = c.bytes.load();
+    s.visited = c.visited.load();
+    s.recorded = c.recorded.load();
+    s.swept = c.swept.load();
+    for (size_t i=0; i < s.seconds.size(); i++) s.seconds[i] = 1e-9 * c.nanoseconds[i].load();
+#endif
+    return s;
+}
+
+inline void reset_stats() {
+#ifdef AUTODIFF_PROFILE
+    profile::Counters &c = profile::counters();
+    for (auto &n : c.nodes) n = 0;
+    c.bytes = 0;
+    c.visited = 0;
+    c.recorded = 0;
+    c.swept = 0;
+    for (auto &t : c.nanoseconds) t = 0;
+#endif
+}
+
+inline const char *phase_name(Phase phase) {
+    static const char *names[] = { "construct", "record", "sweep", "accumulate" };
+    return names[static_cast<size_t>(phase)];
+}
+
+}  // namespace autodiff
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+#include <autodiff/node.hpp>
+#include <autodiff/tape.hpp>
+#include <autodiff/vector.hpp>
+
+namespace autodiff {
+
+// Compressed sparse row matrix: the entries of row i are values[k] at column
+// indices[k] for k in [offsets[i], offsets[i + 1]), columns ascending.
+struct SparseMatrix {
+    size_t rows = 0, cols = 0;
+    std::vector<size_t> offsets;
+    std::vector<size_t> indices;
+    std::vector<double> values;
+
+    size_t nonzeros() const { return values.size(); }
+
+    // Row-major dense copy.
+    std::vector<double> dense() const {
+        std::vector<double> res(rows * cols, 0.0);
+        for (size_t i=0; i < rows; i++) {
+            for (size_t k=offsets[i]; k < offsets[i + 1]; k++) res[i * cols + indices[k]] = values[k];
+        }
+        return res;
+    }
+};
+
+// Jacobian whose sparsity pattern is read off the graph. Each tape entry gets
+// the sorted set of inputs it depends on; an output's set is its row pattern.
+// Rows are then colored greedily so that no two rows of one color share a
+// column, and every color becomes one lane of a multi-lane reverse sweep:
+// seeding all rows of a color at once cannot mix their adjoints, since each
+// input receives an adjoint from at most one of them. The number of sweeps
+// follows the number of colors instead of the number of outputs; a banded
+// function of bandwidth w needs at most 2w - 1 of them.
+//
+// The pattern is structural: an entry stays in it even when its value
+// happens to be zero at this point.
+class SparseJacobian {
+ public:
+    SparseJacobian(const std::vector<Node *> &outputs, const std::vector<Node *> &inputs)
+      : m_tape(outputs), m_inputs(inputs) {
+        detect(outputs.size());
+        color();
+    }
+
+    // Outputs are the elements of `outputs`, inputs those of `inputs`.
+    SparseJacobian(const Vector &outputs, const Vector &inputs)
+      : SparseJacobian(outputs.roots(), inputs.roots()) {}
+
+    size_t colors() const { return m_colors; }
+    const std::vector<size_t> &row_colors() const { return m_rowColors; }
+
+    // Pattern only; values are left empty.
+    const SparseMatrix &pattern() const { return m_pattern; }
+
+    // Values at the graph's current point, with up to `lanes` colors per sweep.
+    SparseMatrix evaluate(size_t lanes = 16) {
+        if (lanes == 0) throw std::runtime_error("lanes must be positive");
+        SparseMatrix res = m_pattern;
+        res.values.assign(res.indices.size(), 0.0);
+        const size_t m = m_pattern.rows;
+        for (size_t first=0; first < m_colors; first += lanes) {
+            const size_t k = std::min(lanes, m_colors - first);
+            std::vector<double> seeds(m * k, 0.0);
+            for (size_t i=0; i < m; i++) {
+                if (m_rowColors[i] >= first && m_rowColors[i] < first + k) {
+                    seeds[i * k + m_rowColors[i] - first] = 1.0;
+                }
+            }
+            m_tape.propagate(seeds, k);
+            for (size_t i=0; i < m; i++) {
+                if (m_rowColors[i] < first || m_rowColors[i] >= first + k) continue;
+                for (size_t p=res.offsets[i]; p < res.offsets[i + 1]; p++) {
+                    res.values[p] = m_tape.adjoint(m_columns[res.indices[p]], m_rowColors[i] - first);
+                }
+            }
+        }
+        return res;
+    }
+
+ private:
+    // Forward pass over the tape merging operand dependency sets. Sets hold
+    // the first column of each input leaf; an input listed more than once
+    // shares its tape entry and is expanded into all its columns at the end.
+    void detect(size_t rows) {
+        const size_t n = m_tape.size();
+        std::vector<std::vector<uint32_t>> deps(n);
+        std::vector<std::vector<size_t>> aliases(m_inputs.size());
+        m_columns.assign(m_inputs.size(), n);
+        for (size_t j=0; j < m_inputs.size(); j++) {
+            if (m_inputs[j]->arity()) throw std::runtime_error("jacobian inputs must be leaves");
+            size_t index = m_tape.index(m_inputs[j]);
+            if (index == n) continue;
+            m_columns[j] = index;
+            if (deps[index].empty()) deps[index].push_back(static_cast<uint32_t>(j));
+            aliases[deps[index].front()].push_back(j);
+        }
+        std::vector<uint32_t> merged;
+        for (size_t i=0; i < n; i++) {
+            for (size_t k=0; k < m_tape.arity(i); k++) {
+                const std::vector<uint32_t> &d = deps[m_tape.operand(i, k)];
+                merged.clear();
+                std::set_union(deps[i].begin(), deps[i].end(), d.begin(), d.end(), std::back_inserter(merged));
+                deps[i].swap(merged);
+            }
+        }
+
+        m_pattern.rows = rows;
+        m_pattern.cols = m_inputs.size();
+        m_pattern.offsets.assign(1, 0);
+        for (size_t r=0; r < rows; r++) {
+            const size_t begin = m_pattern.indices.size();
+            for (uint32_t j : deps[m_tape.root(r)]) {
+                m_pattern.indices.insert(m_pattern.indices.end(), aliases[j].begin(), aliases[j].end());
+            }
+            std::sort(m_pattern.indices.begin() + begin, m_pattern.indices.end());
+            m_pattern.offsets.push_back(m_pattern.indices.size());
+        }
+    }
+
+    // Greedy distance-1 coloring of the row intersection graph, rows in order.
+    void color() {
+        const size_t m = m_pattern.rows, n = m_pattern.cols;
+        const size_t none = static_cast<size_t>(-1);
+        // Rows already colored that touch each column.
+        std::vector<std::vector<size_t>> users(n);
+        std::vector<size_t> forbidden;
+        m_rowColors.assign(m, 0);
+        m_colors = 0;
+        for (size_t i=0; i < m; i++) {
+            forbidden.assign(m_colors + 1, none);
+            for (size_t p=m_pattern.offsets[i]; p < m_pattern.offsets[i + 1]; p++) {
+                for (size_t other : users[m_pattern.indices[p]]) forbidden[m_rowColors[other]] = i;
+            }
+            size_t c = 0;
+            while (forbidden[c] == i) c++;
+            m_rowColors[i] = c;
+            m_colors = std::max(m_colors, c + 1);
+            for (size_t p=m_pattern.offsets[i]; p < m_pattern.offsets[i + 1]; p++) {
+                users[m_pattern.indices[p]].push_back(i);
+            }
+        }
+    }
+
+    Tape m_tape;
+    std::vector<Node *> m_inputs;
+    std::vector<size_t> m_columns;
+    std::vector<size_t> m_rowColors;
+    size_t m_colors = 0;
+    SparseMatrix m_pattern;
+};
+
+// Sparse Jacobian of `outputs` with respect to `inputs`, in CSR form.
+inline SparseMatrix sparse_jacobian(const Vector &outputs, const Vector &inputs, size_t lanes = 16) {
+    return SparseJacobian(outputs, inputs).evaluate(lanes);
+}
+
+}  // namespace autodiff
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <autodiff/node.hpp>
+#include <autodiff/profile.hpp>
+
+namespace autodiff {
+
+namespace detail {
+
+// Open-addressing map from node to tape position. Recording touches every
+// node of the graph, so this avoids a heap allocation per entry.
+class NodeIndex {
+ public:
+    NodeIndex() { rehash(64); }
+
+    // Returns false if the key was already present.
+    bool insert(const Node *key, size_t value) {
+        if (2 * (m_size + 1) > m_keys.size()) rehash(2 * m_keys.size());
+        size_t slot = probe(key);
+        if (m_keys[slot] == key) return false;
+        m_keys[slot] = key;
+        m_values[slot] = value;
+        m_size++;
+        return true;
+    }
+
+    bool contains(const Node *key) const { return m_keys[probe(key)] == key; }
+
+    const size_t *find(const Node *key) const {
+        size_t slot = probe(key);
+        return m_keys[slot] == key ? &m_values[slot] : nullptr;
+    }
+
+    size_t &operator[](const Node *key) { return m_values[probe(key)]; }
+
+ private:
+    size_t probe(const Node *key) const {
+        size_t mask = m_keys.size() - 1;
+        uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key)) * 0x9E3779B97F4A7C15ull;
+        size_t slot = static_cast<size_t>(hash >> m_shift);
+        while (m_keys[slot] && m_keys[slot] != key) slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<const Node *> keys(capacity, nullptr);
+        std::vector<size_t> values(capacity);
+        m_shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) m_shift--;
+        keys.swap(m_keys);
+        values.swap(m_values);
+        for (size_t i=0; i < keys.size(); i++) {
+            if (!keys[i]) continue;
+            size_t slot = probe(keys[i]);
+            m_keys[slot] = keys[i];
+            m_values[slot] = values[i];
+        }
+    }
+
+    std::vector<const Node *> m_keys;
+    std::vector<size_t> m_values;
+    size_t m_size = 0;
+    unsigned m_shift = 64;
+};
+
+}  // namespace detail
+
+// Wengert list of every node reachable from a set of roots, stored in
+// creation order. A backward sweep walks it once in reverse, so each node
+// sums its adjoint from all consumers and propagates it exactly once,
+// no matter how many paths lead to it.
+//
+// The tape keeps raw pointers: the roots must outlive it.
+class Tape {
+ public:
+    Tape() {}
+
+    explicit Tape(const std::vector<Node *> &roots) {
+        record(roots);
+    }
+
+    void record(const std::vector<Node *> &roots) {
+        profile::Timer timer(Phase::Record);
+        m_nodes.clear();
+        m_offsets.clear();
+        m_operands.clear();
+        m_roots.clear();
+        m_index = detail::NodeIndex();
+        m_maxArity = 0;
+        m_hooked.clear();
+
+        // Sort (order, node) pairs so comparisons never dereference nodes.
+        std::vector<std::pair<uint64_t, Node *>> found;
+        detail::NodeIndex &index = m_index;
+        std::vector<Node *> stack(roots.begin(), roots.end());
+        size_t visited = roots.size();
+        while (!stack.empty()) {
+            Node *node = stack.back();
+            stack.pop_back();
+            if (!index.insert(node, 0)) continue;
+            found.emplace_back(node->order, node);
+            visited += node->arity();
+            for (size_t i=0; i < node->arity(); i++) {
+                Node *operand = node->operand(i);
+                if (!index.contains(operand)) stack.push_back(operand);
+            }
+        }
+
+        profile::visited(visited);
+        profile::recorded(found.size());
+        std::sort(found.begin(), found.end());
+
+        m_nodes.reserve(found.size());
+        for (size_t i=0; i < found.size(); i++) {
+            m_nodes.push_back(found[i].second);
+            index[found[i].second] = i;
+        }
+
+        m_offsets.reserve(m_nodes.size() + 1);
+        m_offsets.push_back(0);
+        for (size_t k=0; k < m_nodes.size(); k++) {
+            const Node *node = m_nodes[k];
+            for (size_t i=0; i < node->arity(); i++) {
+                m_operands.push_back(index[node->operand(i)]);
+            }
+            m_maxArity = std::max(m_maxArity, node->arity());
+            m_offsets.push_back(m_operands.size());
+            if (node->opcode() == OpCode::Checkpoint) {
+                m_hooked.resize(m_nodes.size(), 0);
+                m_hooked[k] = 1;
+            }
+        }
+
+        m_roots.reserve(roots.size());
+        for (const Node *root : roots) {
+            m_roots.push_back(index[root]);
+        }
+    }
+
+    size_t size() const { return m_nodes.size(); }
+
+    // True if the tape holds nodes with a backward hook (checkpoints), whose
+    // shared state rules out sweeping tapes that overlap concurrently.
+    bool hooked() const { return !m_hooked.empty(); }
+
+    // Re-runs every recorded node's forward computation in order, so values
+    // follow leaves that were changed in place.
+    void evaluate() {
+        for (Node *node : m_nodes) {
+            if (node->opcode() == OpCode::Fused) throw std::runtime_error("fused nodes cannot be re-evaluated");
+            node->evaluate();
+        }
+    }
+
+    // Computes the adjoint of every recorded node, seeding root i with seeds[i].
+    void propagate(const std::vector<double> &seeds) {
+        seed(seeds);
+        profile::Timer timer(Phase::Sweep);
+        profile::swept(size());
+        m_partials.resize(m_maxArity);
+        for (size_t i=size(); i-- > 0;) {
+            pull(i, m_partials.data());
+        }
+    }
+
+    // Sweeps `lanes` seed vectors at once; seeds[r * lanes + l] seeds root r
+    // in lane l. Each node keeps its lanes in one contiguous block, so its
+    // partials are computed once for all of them. Read the results with
+    // adjoint(index, lane).
+    void propagate(const std::vector<double> &seeds, size_t lanes) {
+        if (lanes == 1) {
+            propagate(seeds);
+            return;
+        }
+        if (seeds.size() != m_roots.size() * lanes) throw std::runtime_error("seed size not same");
+        if (!m_hooked.empty()) throw std::runtime_error("checkpointed graphs need single-lane sweeps");
+        m_lanes = lanes;
+        m_adjoints.assign(size() * lanes, 0.0);
+        for (size_t r=0; r < m_roots.size(); r++) {
+            for (size_t l=0; l < lanes; l++) m_adjoints[m_roots[r] * lanes + l] += seeds[r * lanes + l];
+        }
+
+        profile::Timer timer(Phase::Sweep);
+        profile::swept(size());
+        std::vector<double> partials(m_maxArity);
+        for (size_t i=size(); i-- > 0;) {
+            const double *adjoint = &m_adjoints[i * lanes];
+            m_nodes[i]->partials(partials.data());
+            for (size_t k=m_offsets[i]; k < m_offsets[i+1]; k++) {
+                const double partial = partials[k - m_offsets[i]];
+                double *out = &m_adjoints[m_operands[k] * lanes];
+                for (size_t l=0; l < lanes; l++) out[l] += partial * adjoint[l];
+            }
+        }
+    }
+
+    // Resets all adjoints and seeds the roots, without sweeping.
+    void seed(const std::vector<double> &seeds) {
+        if (seeds.size() != m_roots.size()) throw std::runtime_error("seed size not same");
+        m_lanes = 1;
+        m_adjoints.assign(size(), 0.0);
+        for (size_t i=0; i < m_roots.size(); i++) {
+            m_adjoints[m_roots[i]] += seeds[i];
+        }
+    }
+
+    // Sweeps only the given entries (ascending tape indices) after seed().
+    // Sweeps over entry sets that share no operands may run concurrently.
+    void sweep(const std::vector<size_t> &entries) {
+        profile::Timer timer(Phase::Sweep);
+        profile::swept(entries.size());
+        std::vector<double> partials(m_maxArity);
+        for (size_t k=entries.size(); k-- > 0;) {
+            pull(entries[k], partials.data());
+        }
+    }
+
+    // Hands each node its adjoint from the last single-lane propagate();
+    // variables add it to grad.
+    void accumulate() {
+        if (m_lanes != 1) throw std::runtime_error("accumulate needs a single lane");
+        profile::Timer timer(Phase::Accumulate);
+        for (size_t i=0; i < size(); i++) {
+            m_nodes[i]->accumulate(m_adjoints[i]);
+        }
+    }
+
+    void accumulate(const std::vector<size_t> &entries) {
+        profile::Timer timer(Phase::Accumulate);
+        for (size_t i : entries) {
+            m_nodes[i]->accumulate(m_adjoints[i]);
+        }
+    }
+
+    void backward(const std::vector<double> &seeds) {
+        propagate(seeds);
+        accumulate();
+    }
+
+    double adjoint(size_t index, size_t lane = 0) const { return m_adjoints[index * m_lanes + lane]; }
+    Node *node(size_t index) const { return m_nodes[index]; }
+    size_t root(size_t i) const { return m_roots[i]; }
+
+    // Tape index of `node`, or size() if it is not on the tape.
+    size_t index(const Node *node) const {
+        const size_t *i = m_index.find(node);
+        return i ? *i : size();
+    }
+
+    // Tape indices of the operands of entry `index`.
+    size_t arity(size_t index) const { return m_offsets[index + 1] - m_offsets[index]; }
+    size_t operand(size_t index, size_t k) const { return m_operands[m_offsets[index] + k]; }
+
+ private:
+    void pull(size_t i, double *partials) {
+        double adjoint = m_adjoints[i];
+        if (!m_hooked.empty() && m_hooked[i]) adjoint = m_nodes[i]->receive(adjoint);
+        m_nodes[i]->partials(partials);
+        for (size_t k=m_offsets[i]; k < m_offsets[i+1]; k++) {
+            m_adjoints[m_operands[k]] += partials[k - m_offsets[i]] * adjoint;
+        }
+    }
+
+    std::vector<Node *> m_nodes;
+    std::vector<size_t> m_offsets;
+    std::vector<size_t> m_operands;
+    std::vector<size_t> m_roots;
+    std::vector<double> m_adjoints;
+    std::vector<double> m_partials;
+    detail::NodeIndex m_index;
+    size_t m_lanes = 1;
+    size_t m_maxArity = 0;
+    // Flags entries with a receive() hook; empty when there are none.
+    std::vector<uint8_t> m_hooked;
+};
+
+inline void Node::prop(const double &output) {
+    Tape tape(std::vector<Node *>(1, this));
+    tape.backward(std::vector<double>(1, output));
+}
+
+}  // namespace autodiff
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+#include <autodiff/kernels.hpp>
+
+namespace autodiff {
+
+// Graph node over a whole array. Values and gradients live in contiguous
+// buffers and every op runs forward and backward as one elementwise kernel,
+// so a Tensor expression costs one node per op instead of one per element.
+struct TensorNode {
+    std::vector<double> value;
+    std::vector<double> grad;
+
+    explicit TensorNode(size_t n) : value(n) {}
+    virtual ~TensorNode() {}
+
+    size_t size() const { return value.size(); }
+
+    virtual size_t arity() const { return 0; }
+    virtual TensorNode *operand(size_t /*i*/) const { return nullptr; }
+
+    // Adds grad, pulled back through this op, into the operands' grad buffers.
+    virtual void backprop() {}
+};
+
+struct BinaryTensorNode: TensorNode {
+    std::shared_ptr<TensorNode> left, right;
+
+    BinaryTensorNode(const std::shared_ptr<TensorNode> &l,
+        const std::shared_ptr<TensorNode> &r) :
+        TensorNode(l->size()),
+        left(l),
+        right(r)
+        {}
+
+    size_t arity() const override { return 2; }
+    TensorNode *operand(size_t i) const override { return i == 0 ? left.get() : right.get(); }
+};
+
+struct AddTensorNode: BinaryTensorNode {
+    AddTensorNode(const std::shared_ptr<TensorNode> &l,
+        const std::shared_ptr<TensorNode> &r) :
+        BinaryTensorNode(l, r) {
+        kernels::add(size(), left->value.data(), right->value.data(), value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate(size(), 1.0, grad.data(), left->grad.data());
+        kernels::accumulate(size(), 1.0, grad.data(), right->grad.data());
+    }
+};
+
+struct SubTensorNode: BinaryTensorNode {
+    SubTensorNode(const std::shared_ptr<TensorNode> &l,
+        const std::shared_ptr<TensorNode> &r) :
+        BinaryTensorNode(l, r) {
+        kernels::sub(size(), left->value.data(), right->value.data(), value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate(size(), 1.0, grad.data(), left->grad.data());
+        kernels::accumulate(size(), -1.0, grad.data(), right->grad.data());
+    }
+};
+
+struct MulTensorNode: BinaryTensorNode {
+    MulTensorNode(const std::shared_ptr<TensorNode> &l,
+        const std::shared_ptr<TensorNode> &r) :
+        BinaryTensorNode(l, r) {
+        kernels::mul(size(), left->value.data(), right->value.data(), value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate_mul(size(), grad.data(), right->value.data(), left->grad.data());
+        kernels::accumulate_mul(size(), grad.data(), left->value.data(), right->grad.data());
+    }
+};
+
+struct DivTensorNode: BinaryTensorNode {
+    DivTensorNode(const std::shared_ptr<TensorNode> &l,
+        const std::shared_ptr<TensorNode> &r) :
+        BinaryTensorNode(l, r) {
+        kernels::div(size(), left->value.data(), right->value.data(), value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate_div(size(), grad.data(), right->value.data(), left->grad.data());
+        kernels::accumulate_quotient(size(), grad.data(), value.data(), right->value.data(), right->grad.data());
+    }
+};
+
+struct UnaryTensorNode: TensorNode {
+    std::shared_ptr<TensorNode> m;
+
+    explicit UnaryTensorNode(const std::shared_ptr<TensorNode> &m) :
+        TensorNode(m->size()),
+        m(m)
+        {}
+
+    size_t arity() const override { return 1; }
+    TensorNode *operand(size_t) const override { return m.get(); }
+};
+
+// scale * x + shift; covers negation and every op with a scalar operand but c / x.
+struct AffineTensorNode: UnaryTensorNode {
+    double scale;
+
+    AffineTensorNode(const std::shared_ptr<TensorNode> &m, double scale, double shift) :
+        UnaryTensorNode(m),
+        scale(scale) {
+        kernels::affine(size(), m->value.data(), scale, shift, value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate(size(), scale, grad.data(), m->grad.data());
+    }
+};
+
+// c / x
+struct RecipTensorNode: UnaryTensorNode {
+    RecipTensorNode(const std::shared_ptr<TensorNode> &m, double c) :
+        UnaryTensorNode(m) {
+        kernels::recip(size(), c, m->value.data(), value.data());
+    }
+
+    void backprop() override{
+        kernels::accumulate_quotient(size(), grad.data(), value.data(), m->value.data(), m->grad.data());
+    }
+};
+
+struct SinTensorNode: UnaryTensorNode {
+    explicit SinTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::sin(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::sin_backward(size(), grad.data(), m->value.data(), m->grad.data());
+    }
+};
+
+struct CosTensorNode: UnaryTensorNode {
+    explicit CosTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::cos(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::cos_backward(size(), grad.data(), m->value.data(), m->grad.data());
+    }
+};
+
+struct TanTensorNode: UnaryTensorNode {
+    explicit TanTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::tan(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::tan_backward(size(), grad.data(), value.data(), m->grad.data());
+    }
+};
+
+struct ExpTensorNode: UnaryTensorNode {
+    explicit ExpTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::exp(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::accumulate_mul(size(), grad.data(), value.data(), m->grad.data());
+    }
+};
+
+struct LogTensorNode: UnaryTensorNode {
+    explicit LogTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::log(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::accumulate_div(size(), grad.data(), m->value.data(), m->grad.data());
+    }
+};
+
+struct SqrtTensorNode: UnaryTensorNode {
+    explicit SqrtTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::sqrt(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::sqrt_backward(size(), grad.data(), value.data(), m->grad.data());
+    }
+};
+
+struct AbsTensorNode: UnaryTensorNode {
+    explicit AbsTensorNode(const std::shared_ptr<TensorNode> &m) : UnaryTensorNode(m) {
+        kernels::abs(size(), m->value.data(), value.data());
+    }
+    void backprop() override{
+        kernels::abs_backward(size(), grad.data(), m->value.data(), m->grad.data());
+    }
+};
+
+// Elementwise array with the same interface as Vector, backed by TensorNodes.
+// Leaf gradients accumulate across backward() calls like Variable gradients.
+class Tensor {
+ public:
+    explicit Tensor(size_t nsize)
+      : m_node(std::make_shared<TensorNode>(nsize)) {}
+
+    Tensor(const std::vector<double> &v)  // NOLINT(runtime/explicit)
+      : m_node(std::make_shared<TensorNode>(v.size())) {
+        m_node->value = v;
+    }
+
+    Tensor(const double *data, size_t nsize)
+      : m_node(std::make_shared<TensorNode>(nsize)) {
+        std::copy(data, data + nsize, m_node->value.begin());
+    }
+
+    explicit Tensor(const std::shared_ptr<TensorNode> &node) : m_node(node) {}
+
+    size_t size() const { return m_node->size(); }
+
+    const double *data() const { return m_node->value.data(); }
+    double *data() { return m_node->value.data(); }
+
+    // Gradient storage, allocated on first use. Its address is stable from
+    // then on, so it can back views that outlive later backward() calls.
+    double *grad_data() {
+        if (m_node->grad.empty()) m_node->grad.assign(size(), 0.0);
+        return m_node->grad.data();
+    }
+
+    bool is_leaf() const { return m_node->arity() == 0; }
+    const std::shared_ptr<TensorNode> &node() const { return m_node; }
+
+    std::vector<double> values() const { return m_node->value; }
+
+    std::vector<double> grad() const {
+        if (m_node->grad.empty()) return std::vector<double>(size(), 0.0);
+        return m_node->grad;
+    }
+
+    void backward() {
+        std::vector<TensorNode *> order = topological_order();
+        for (TensorNode *node : order) {
+            if (node->arity()) {
+                node->grad.assign(node->size(), 0.0);
+            } else if (node->grad.empty()) {
+                node->grad.assign(node->size(), 0.0);
+            }
+        }
+        for (double &g : m_node->grad) g += 1.0;
+        for (size_t i=order.size(); i-- > 0;) {
+            order[i]->backprop();
+        }
+    }
+
+    double getitem(int index) const {
+        if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
+        return m_node->value[index];
+    }
+
+    void setitem(int index, double value) {
+        if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
+        if (m_node->arity()) throw std::runtime_error("cannot assign into a computed tensor");
+        m_node->value[index] = value;
+    }
+
+    std::string info() const {
+        std::string res;
+        res += "[ ";
+        for (size_t i=0; i < size(); i++) {
+            res += std::to_string(m_node->value[i]);
+            res += " ";
+        }
+        res += "]";
+        return res;
+    }
+
+    Tensor operator+(const Tensor &r) const { return binary<AddTensorNode>(r); }
+    Tensor operator-(const Tensor &r) const { return binary<SubTensorNode>(r); }
+    Tensor operator*(const Tensor &r) const { return binary<MulTensorNode>(r); }
+    Tensor operator/(const Tensor &r) const { return binary<DivTensorNode>(r); }
+
+    Tensor operator-() const { return affine(-1.0, 0.0); }
+
+    Tensor operator+(const double &r) const { return affine(1.0, r); }
+    Tensor operator-(const double &r) const { return affine(1.0, -r); }
+    Tensor operator*(const double &r) const { return affine(r, 0.0); }
+    Tensor operator/(const double &r) const { return affine(1.0 / r, 0.0); }
+
+    friend Tensor operator+(double l, const Tensor &r) { return r.affine(1.0, l); }
+    friend Tensor operator-(double l, const Tensor &r) { return r.affine(-1.0, l); }
+    friend Tensor operator*(double l, const Tensor &r) { return r.affine(l, 0.0); }
+    friend Tensor operator/(double l, const Tensor &r) {
+        return Tensor(std::make_shared<RecipTensorNode>(r.m_node, l));
+    }
+
+    Tensor sin() const { return unary<SinTensorNode>(); }
+    Tensor cos() const { return unary<CosTensorNode>(); }
+    Tensor tan() const { return unary<TanTensorNode>(); }
+    Tensor exp() const { return unary<ExpTensorNode>(); }
+    Tensor log() const { return unary<LogTensorNode>(); }
+    Tensor sqrt() const { return unary<SqrtTensorNode>(); }
+    Tensor abs() const { return unary<AbsTensorNode>(); }
+
+ private:
+    template <class T>
+    Tensor binary(const Tensor &r) const {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        return Tensor(std::make_shared<T>(m_node, r.m_node));
+    }
+
+    template <class T>
+    Tensor unary() const {
+        return Tensor(std::make_shared<T>(m_node));
+    }
+
+    Tensor affine(double scale, double shift) const {
+        return Tensor(std::make_shared<AffineTensorNode>(m_node, scale, shift));
+    }
+
+    // Post-order over the graph: operands before the nodes consuming them.
+    std::vector<TensorNode *> topological_order() const {
+        std::vector<TensorNode *> order;
+        std::unordered_set<TensorNode *> seen;
+        std::vector<std::pair<TensorNode *, size_t>> stack;
+        stack.emplace_back(m_node.get(), 0);
+        seen.insert(m_node.get());
+        while (!stack.empty()) {
+            TensorNode *node = stack.back().first;
+            size_t next = stack.back().second++;
+            if (next < node->arity()) {
+                TensorNode *operand = node->operand(next);
+                if (seen.insert(operand).second) stack.emplace_back(operand, 0);
+            } else {
+                order.push_back(node);
+                stack.pop_back();
+            }
+        }
+        return order;
+    }
+
+    std::shared_ptr<TensorNode> m_node;
+};
+
+}  // namespace autodiff
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace autodiff {
+
+// Fixed set of worker threads running one parallel_for at a time. The calling
+// thread takes part in the loop, so a pool of size n uses n - 1 workers.
+// A parallel_for issued while another one is running (including from inside a
+// task) runs serially on the caller instead of waiting for the pool.
+class ThreadPool {
+ public:
+    explicit ThreadPool(size_t threads) {
+        start(threads);
+    }
+
+    ~ThreadPool() { stop(); }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool& operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    // Changes the number of threads. Waits for a running parallel_for to
+    // finish; loops issued meanwhile run serially on their caller. Must not
+    // be called from inside a task.
+    void resize(size_t threads) {
+        std::lock_guard<std::mutex> busy(m_busy);
+        stop();
+        start(threads);
+    }
+
+    // Calls fn(i) for every i in [0, n) and returns once all calls are done.
+    // The first exception thrown by a task is rethrown here.
+    void parallel_for(size_t n, const std::function<void(size_t)> &fn) {
+        std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+        if (!busy.owns_lock() || m_workers.empty() || n < 2) {
+            for (size_t i=0; i < n; i++) fn(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &fn;
+            m_count = n;
+            m_next = 0;
+            m_pending = m_workers.size();
+            m_error = nullptr;
+            m_generation++;
+        }
+        m_wake.notify_all();
+        run();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending == 0; });
+        m_task = nullptr;
+        if (m_error) std::rethrow_exception(m_error);
+    }
+
+    // Process-wide pool used by the parallel Vector and backward paths,
+    // created on first use from any thread. It lives until exit, so the
+    // reference stays valid across set_num_threads.
+    static ThreadPool &instance() {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+
+    // Resizes the process-wide pool in place; see resize().
+    static void set_num_threads(size_t threads) {
+        instance().resize(threads);
+    }
+
+ private:
+    // Called with m_busy held or before the pool is shared. New workers
+    // start at the current generation so they skip the last, finished loop.
+    void start(size_t threads) {
+        m_size = std::max<size_t>(threads, 1);
+        const size_t generation = m_generation;
+        for (size_t i=1; i < m_size; i++) {
+            m_workers.emplace_back([this, generation] { work(generation); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread &worker : m_workers) worker.join();
+        m_workers.clear();
+        m_stop = false;
+    }
+
+    void run() {
+        for (size_t i = m_next++; i < m_count; i = m_next++) {
+            try {
+                (*m_task)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error) m_error = std::current_exception();
+            }
+        }
+    }
+
+    void work(size_t seen) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop) return;
+                seen = m_generation;
+            }
+            run();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending--;
+            }
+            m_done.notify_one();
+        }
+    }
+
+    std::atomic<size_t> m_size{1};
+    std::vector<std::thread> m_workers;
+    std::mutex m_busy;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)> *m_task = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_pending = 0;
+    size_t m_generation = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+};
+
+}  // namespace autodiff
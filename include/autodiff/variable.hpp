@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <vector>
+#include <autodiff/arena.hpp>
 #include <autodiff/node.hpp>
 
 namespace autodiff {
@@ -11,14 +12,16 @@ struct Variable {
 
     Variable() : Variable(0.0) {}
 
-    Variable(const Variable &o) : Variable(o.VarNodePtr) {}
+    Variable(const Variable &o) : VarNodePtr(o.VarNodePtr) {}
 
+    // Refers to the node itself: only leaves made from a double carry a
+    // gradient, an op result reports 0.
     Variable(const std::shared_ptr<Node> &v) :
-        VarNodePtr(std::make_shared<DepVarNode>(v))
+        VarNodePtr(v)
         {}
 
     Variable(const double &v) :
-        VarNodePtr(std::make_shared<IndVarNode>(v))
+        VarNodePtr(make_node<IndVarNode>(v))
         {}
 
     Variable& operator=(const Variable& o) {
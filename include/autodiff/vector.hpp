@@ -1,34 +1,58 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <new>
+#include <utility>
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <autodiff/parallel.hpp>
+#include <autodiff/tape.hpp>
 #include <autodiff/variable.hpp>
 #include <autodiff/mathfunctions.hpp>
+#include <autodiff/vmath.hpp>
 
 namespace autodiff {
 
+// Owns a contiguous buffer of elements. Copies copy the elements, which
+// share their nodes with the original; moves hand the buffer over.
 class Vector {
  public:
-    Vector(size_t nsize)
-      : m_size(nsize) {
-        if (size()) {
-            m_buffer = new Variable[size()];
-        } else {
-            m_buffer = nullptr;
+    Vector(size_t nsize) {
+        *this = generate(nsize, [](size_t) { return Variable(); });
+    }
+
+    Vector(const Vector &o)
+      : m_tape(o.m_tape) {
+        allocate(o.size());
+        for (size_t i=0; i < size(); i++) {
+            new (&m_buffer[i]) Variable(o.m_buffer[i]);
         }
     }
+
+    Vector(Vector &&o) noexcept
+      : m_size(o.m_size), m_buffer(o.m_buffer), m_tape(std::move(o.m_tape)) {
+        o.m_size = 0;
+        o.m_buffer = nullptr;
+    }
+
+    // Copy and move assignment alike: a copy is made by the parameter.
+    Vector& operator=(Vector o) noexcept {
+        std::swap(m_size, o.m_size);
+        std::swap(m_buffer, o.m_buffer);
+        std::swap(m_tape, o.m_tape);
+        return *this;
+    }
+
+    ~Vector() { release(); }
+
     Vector(std::vector<double> &v)
-      : m_size(v.size()) {
-          if (size()) {
-              m_buffer = new Variable[size()];
-              for (size_t i=0; i < v.size(); i++) {
-                  m_buffer[i] = v[i];
-              }
-          } else {
-              m_buffer = nullptr;
-          }
+      : Vector(v.data(), v.size()) {}
+
+    // Leaves initialized straight from a contiguous buffer.
+    Vector(const double *data, size_t nsize) {
+        *this = generate(nsize, [&](size_t i) { return data[i]; });
     }
 
     size_t size() const { return m_size; }
@@ -51,11 +75,90 @@ class Vector {
         return value;
     }
 
+    // Write into caller-provided buffers of size() doubles.
+    void grad(double *out) const {
+        for (size_t i=0; i < size(); i++) {
+            out[i] = m_buffer[i].VarNodePtr->getGradient();
+        }
+    }
+
+    void values(double *out) const {
+        for (size_t i=0; i < size(); i++) {
+            out[i] = m_buffer[i].VarNodePtr->value;
+        }
+    }
+
+    // Element nodes, in order, for seeding a tape.
+    std::vector<Node *> roots() const {
+        std::vector<Node *> res;
+        res.reserve(size());
+        for (size_t i=0; i < size(); i++) {
+            res.push_back(m_buffer[i].VarNodePtr.get());
+        }
+        return res;
+    }
+
     void backward() {
+        backward(std::vector<double>(size(), 1.0));
+    }
+
+    // Vector-Jacobian product: adds seed^T J into the leaves' grad.
+    void backward(const std::vector<double> &seed) {
+        if (seed.size() != size()) throw std::runtime_error("seed size not same");
+        if (Tape *tape = retainedTape()) {
+            tape->backward(seed);
+            return;
+        }
+        Tape tape(roots());
+        tape.backward(seed);
+    }
+
+    // Sets the grad of every element back to zero.
+    void zero_grad() {
         for (size_t i=0; i < size(); i++) {
-            (*this)(i).VarNodePtr->prop(1.0);
+            m_buffer[i].VarNodePtr->setGradient(0.0);
         }
     }
+
+    // Overwrites the values of leaf elements in place. The nodes stay the
+    // same, so graphs already built on them pick the new values up on their
+    // next forward().
+    void set_values(const double *data) {
+        for (size_t i=0; i < size(); i++) {
+            if (m_buffer[i].VarNodePtr->arity()) throw std::runtime_error("only leaves can be set in place");
+        }
+        for (size_t i=0; i < size(); i++) {
+            m_buffer[i].VarNodePtr->value = data[i];
+        }
+    }
+
+    void set_values(const std::vector<double> &v) {
+        if (v.size() != size()) throw std::runtime_error("size not same");
+        set_values(v.data());
+    }
+
+    // Retain mode: the graph behind this Vector is recorded once and kept,
+    // backward() reuses it and forward() recomputes its values in place, so
+    // a loop of set_values / forward / zero_grad / backward on the same
+    // leaves allocates no nodes. Replacing an element ends retain mode,
+    // through setitem or an assignment to operator[] alike.
+    void retain(bool on = true) {
+        m_tape = on ? std::make_shared<Retained>(nodes()) : nullptr;
+    }
+
+    bool retained() const { return m_tape && !m_tape->replaced(*this); }
+
+    void forward() {
+        Tape *tape = retainedTape();
+        if (!tape) throw std::runtime_error("forward needs retain()");
+        tape->evaluate();
+    }
+
+    // Same as backward() with the elements' graphs swept on the thread pool;
+    // see parallel_backward for what deterministic trades off.
+    void backward_parallel(bool deterministic = true) {
+        parallel_backward(roots(), std::vector<double>(size(), 1.0), deterministic);
+    }
     double getitem(int index) {
         if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
         return m_buffer[index].values();
@@ -64,6 +167,7 @@ class Vector {
     void setitem(int index, double value) {
         if (index < 0 || index >= static_cast<int>(size())) throw std::runtime_error("index out of range");
         m_buffer[index] = value;
+        m_tape = nullptr;
     }
 
     std::string info() {
@@ -85,163 +189,333 @@ class Vector {
 
     Vector operator+(const Vector &r) const {
         if (r.size() != size()) throw std::runtime_error( "size not same" );
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) + r(i);
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] + r.m_buffer[i]; });
     }
 
     Vector operator+(const double &r) const {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) + r;
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] + r; });
     }
 
     friend Vector operator+(double l, const Vector &r) {
-        Vector res(r.size());
-        for (size_t i=0; i < r.size(); i++) {
-            res(i) = l + r(i);
-        }
-        return res;
+        return generate(r.size(), [&](size_t i) { return l + r.m_buffer[i]; });
     }
 
     Vector operator-(const Vector &r) const {
         if (r.size() != size()) throw std::runtime_error( "size not same" );
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) - r(i);
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] - r.m_buffer[i]; });
     }
 
     Vector operator-(const double &r) const {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) - r;
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] - r; });
     }
 
     friend Vector operator-(double l, const Vector &r) {
-        Vector res(r.size());
-        for (size_t i=0; i < r.size(); i++) {
-            res(i) = l - r(i);
-        }
-        return res;
+        return generate(r.size(), [&](size_t i) { return l - r.m_buffer[i]; });
     }
 
     Vector operator*(const Vector &r) const {
         if (r.size() != size()) throw std::runtime_error( "size not same" );
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) * r(i);
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] * r.m_buffer[i]; });
     }
 
     Vector operator*(const double &r) const {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) * r;
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] * r; });
     }
 
     friend Vector operator*(double l, const Vector &r) {
-        Vector res(r.size());
-        for (size_t i=0; i < r.size(); i++) {
-            res(i) = l * r(i);
-        }
-        return res;
+        return generate(r.size(), [&](size_t i) { return l * r.m_buffer[i]; });
     }
 
     Vector operator/(const Vector &r) const {
         if (r.size() != size()) throw std::runtime_error( "size not same" );
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) / r(i);
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] / r.m_buffer[i]; });
     }
 
     Vector operator/(const double &r) const {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res(i) = (*this)(i) / r;
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return m_buffer[i] / r; });
     }
 
     friend Vector operator/(double l, const Vector &r) {
-        Vector res(r.size());
-        for (size_t i=0; i < r.size(); i++) {
-            res(i) = l / r(i);
-        }
-        return res;
+        return generate(r.size(), [&](size_t i) { return l / r.m_buffer[i]; });
     }
 
     Vector sin() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::sin((*this)(i).VarNodePtr);
-        }
-        return res;
+        return map(vmath::sincos, sin_node);
     }
 
     Vector cos() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::cos((*this)(i).VarNodePtr);
-        }
-        return res;
+        return map(vmath::sincos, cos_node);
     }
 
     Vector tan() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::tan((*this)(i).VarNodePtr);
-        }
-        return res;
+        return generate(size(), [&](size_t i) { return autodiff::tan(m_buffer[i].VarNodePtr); });
     }
 
     Vector exp() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::exp((*this)(i).VarNodePtr);
-        }
-        return res;
+        return map(kernel<vmath::exp>, node<ExpOpNode>);
     }
 
     Vector log() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::log((*this)(i).VarNodePtr);
-        }
-        return res;
+        return map(kernel<vmath::log>, node<LogOpNode>);
     }
 
     Vector sqrt() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::sqrt((*this)(i).VarNodePtr);
+        return map(kernel<vmath::sqrt>, node<SqrtOpNode>);
+    }
+
+    Vector abs() {
+        return generate(size(), [&](size_t i) { return autodiff::abs(m_buffer[i].VarNodePtr); });
+    }
+
+    // Reductions over all elements, each a single node with the elements as
+    // operands. dot() and norm2() are the Euclidean inner product and norm.
+    Variable sum() const { return Variable(make_node<SumNode>(nodes())); }
+
+    Variable mean() const {
+        if (!size()) throw std::runtime_error("mean of an empty vector");
+        return Variable(make_node<MeanNode>(nodes()));
+    }
+
+    Variable dot(const Vector &r) const {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        std::vector<std::shared_ptr<Node>> operands = nodes();
+        operands.reserve(2 * size());
+        for (size_t i=0; i < size(); i++) operands.push_back(r.m_buffer[i].VarNodePtr);
+        return Variable(make_node<DotNode>(std::move(operands)));
+    }
+
+    Variable norm2() const { return Variable(make_node<NormNode>(nodes())); }
+
+    // In-place forms: each element is replaced by the result node, written
+    // into the existing buffer. The old elements live on as operands, so
+    // gradients still reach leaves that were replaced; read them through
+    // another Vector holding those leaves. Ends retain mode like setitem.
+    Vector& operator+=(const Vector &r) {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        return update([&](size_t i) { return m_buffer[i] + r.m_buffer[i]; });
+    }
+
+    Vector& operator+=(const double &r) { return update([&](size_t i) { return m_buffer[i] + r; }); }
+
+    Vector& operator-=(const Vector &r) {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        return update([&](size_t i) { return m_buffer[i] - r.m_buffer[i]; });
+    }
+
+    Vector& operator-=(const double &r) { return update([&](size_t i) { return m_buffer[i] - r; }); }
+
+    Vector& operator*=(const Vector &r) {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        return update([&](size_t i) { return m_buffer[i] * r.m_buffer[i]; });
+    }
+
+    Vector& operator*=(const double &r) { return update([&](size_t i) { return m_buffer[i] * r; }); }
+
+    Vector& operator/=(const Vector &r) {
+        if (r.size() != size()) throw std::runtime_error( "size not same" );
+        return update([&](size_t i) { return m_buffer[i] / r.m_buffer[i]; });
+    }
+
+    Vector& operator/=(const double &r) { return update([&](size_t i) { return m_buffer[i] / r; }); }
+
+    Vector& sin_() { return map_(vmath::sincos, sin_node); }
+    Vector& cos_() { return map_(vmath::sincos, cos_node); }
+    Vector& tan_() { return update([&](size_t i) { return autodiff::tan(m_buffer[i].VarNodePtr); }); }
+    Vector& exp_() { return map_(kernel<vmath::exp>, node<ExpOpNode>); }
+    Vector& log_() { return map_(kernel<vmath::log>, node<LogOpNode>); }
+    Vector& sqrt_() { return map_(kernel<vmath::sqrt>, node<SqrtOpNode>); }
+    Vector& abs_() { return update([&](size_t i) { return autodiff::abs(m_buffer[i].VarNodePtr); }); }
+
+    // A temporary on the left hands its buffer on to the result, so chains
+    // like (a * b + c) / d allocate one buffer.
+    friend Vector operator+(Vector &&l, const Vector &r) { return std::move(l += r); }
+    friend Vector operator+(Vector &&l, const double &r) { return std::move(l += r); }
+    friend Vector operator-(Vector &&l, const Vector &r) { return std::move(l -= r); }
+    friend Vector operator-(Vector &&l, const double &r) { return std::move(l -= r); }
+    friend Vector operator*(Vector &&l, const Vector &r) { return std::move(l *= r); }
+    friend Vector operator*(Vector &&l, const double &r) { return std::move(l *= r); }
+    friend Vector operator/(Vector &&l, const Vector &r) { return std::move(l /= r); }
+    friend Vector operator/(Vector &&l, const double &r) { return std::move(l /= r); }
+
+ private:
+    Vector() {}
+
+    // A retained tape and the roots it was recorded from. The tape holds raw
+    // pointers; the roots are kept here so that an element replaced through
+    // operator[] cannot free a node the tape still points to.
+    struct Retained {
+        std::vector<std::shared_ptr<Node>> roots;
+        Tape tape;
+
+        explicit Retained(const std::vector<std::shared_ptr<Node>> &r)
+          : roots(r) {
+            std::vector<Node *> raw;
+            raw.reserve(r.size());
+            for (const auto &node : r) raw.push_back(node.get());
+            tape.record(raw);
+        }
+
+        bool replaced(const Vector &v) const {
+            if (roots.size() != v.size()) return true;
+            for (size_t i=0; i < roots.size(); i++) {
+                if (v.m_buffer[i].VarNodePtr != roots[i]) return true;
+            }
+            return false;
         }
+    };
+
+    // The retained tape, or null outside retain mode; ends retain mode if an
+    // element was replaced since retain().
+    Tape *retainedTape() {
+        if (m_tape && m_tape->replaced(*this)) m_tape = nullptr;
+        return m_tape ? &m_tape->tape : nullptr;
+    }
+
+    std::vector<std::shared_ptr<Node>> nodes() const {
+        std::vector<std::shared_ptr<Node>> res;
+        res.reserve(size());
+        for (size_t i=0; i < size(); i++) res.push_back(m_buffer[i].VarNodePtr);
         return res;
     }
 
-    Vector abs() {
-        Vector res(size());
-        for (size_t i=0; i < size(); i++) {
-            res[i] = autodiff::abs((*this)(i).VarNodePtr);
+    void allocate(size_t n) {
+        m_size = n;
+        m_buffer = n ? static_cast<Variable *>(::operator new(n * sizeof(Variable))) : nullptr;
+    }
+
+    void release() {
+        for (size_t i=0; i < m_size; i++) {
+            m_buffer[i].~Variable();
         }
+        ::operator delete(m_buffer);
+        m_buffer = nullptr;
+        m_size = 0;
+    }
+
+    // Replaces element i with element(i), in parallel chunks for long vectors.
+    template <class F>
+    Vector& update(const F &element) {
+        parallel_for_range(size(), [&](size_t begin, size_t end) {
+            for (size_t i=begin; i < end; i++) {
+                m_buffer[i] = element(i);
+            }
+        });
+        m_tape = nullptr;
+        return *this;
+    }
+
+    // Builds a Vector whose element i is element(i), constructing elements
+    // in parallel chunks for long vectors.
+    template <class F>
+    static Vector generate(size_t n, const F &element) {
+        Vector res;
+        res.allocate(n);
+        parallel_for_range(n, [&](size_t begin, size_t end) {
+            for (size_t i=begin; i < end; i++) {
+                new (&res.m_buffer[i]) Variable(element(i));
+            }
+        });
         return res;
     }
 
- private:
+    // Elementwise math through a vmath kernel f(n, x, a, b): the values of a
+    // block of elements go through f in one call, then store(i, a, b) gets
+    // each element's own results.
+    template <class K, class F>
+    void blocks(const K &f, const F &store) const {
+        parallel_for_range(size(), [&](size_t begin, size_t end) {
+            double x[vmath::block], a[vmath::block], b[vmath::block];
+            for (size_t first=begin; first < end; first += vmath::block) {
+                const size_t n = std::min(vmath::block, end - first);
+                for (size_t j=0; j < n; j++) x[j] = m_buffer[first + j].VarNodePtr->value;
+                f(n, x, a, b);
+                for (size_t j=0; j < n; j++) store(first + j, a[j], b[j]);
+            }
+        });
+    }
+
+    // A Vector whose element i is node(operand i, a, b), or that node in
+    // place of element i for map_().
+    template <class K, class F>
+    Vector map(const K &f, const F &node) const {
+        Vector res;
+        res.allocate(size());
+        blocks(f, [&](size_t i, double a, double b) {
+            new (&res.m_buffer[i]) Variable(node(m_buffer[i].VarNodePtr, a, b));
+        });
+        return res;
+    }
+
+    template <class K, class F>
+    Vector& map_(const K &f, const F &node) {
+        blocks(f, [&](size_t i, double a, double b) { m_buffer[i] = node(m_buffer[i].VarNodePtr, a, b); });
+        m_tape = nullptr;
+        return *this;
+    }
+
+    // A one-output vmath kernel in the form blocks() calls.
+    template <void (*f)(size_t, const double *, double *)>
+    static void kernel(size_t n, const double *x, double *a, double *) { f(n, x, a); }
+
+    template <class T>
+    static std::shared_ptr<Node> node(const std::shared_ptr<Node> &m, double y, double) {
+        return make_node<T>(y, m);
+    }
+
+    static std::shared_ptr<Node> sin_node(const std::shared_ptr<Node> &m, double s, double c) {
+        return make_node<SinOpNode>(s, m, c);
+    }
+
+    static std::shared_ptr<Node> cos_node(const std::shared_ptr<Node> &m, double s, double c) {
+        return make_node<CosOpNode>(c, m, -s);
+    }
+
     size_t m_size = 0;
     Variable * m_buffer = nullptr;
+    std::shared_ptr<Retained> m_tape;
 };
 
+// Runs backward() for several outputs at once: each output's tape is recorded
+// and swept on its own pool thread with its own adjoint buffer, then the
+// results are added into the leaves in the order given, so outputs may share
+// leaves. Outputs may also share checkpointed segments, whose adjoints live
+// in the segment node, so tapes with checkpoints are swept one at a time.
+inline void backward_many(const std::vector<Vector *> &outputs, ThreadPool &pool = ThreadPool::instance()) {
+    std::vector<Tape> tapes(outputs.size());
+    pool.parallel_for(outputs.size(), [&](size_t i) {
+        tapes[i].record(outputs[i]->roots());
+    });
+    auto sweep = [&](size_t i) { tapes[i].propagate(std::vector<double>(outputs[i]->size(), 1.0)); };
+    if (std::any_of(tapes.begin(), tapes.end(), [](const Tape &t) { return t.hooked(); })) {
+        for (size_t i=0; i < tapes.size(); i++) sweep(i);
+    } else {
+        pool.parallel_for(tapes.size(), sweep);
+    }
+    for (Tape &tape : tapes) tape.accumulate();
+}
+
+// Jacobian d(outputs)/d(inputs), row-major with one row per output. The tape
+// is recorded once and rows are swept up to `lanes` at a time, each a unit
+// seed in its own adjoint lane. Leaves' grad is left untouched.
+inline std::vector<double> jacobian(const Vector &outputs, const Vector &inputs, size_t lanes = 16) {
+    if (lanes == 0) throw std::runtime_error("lanes must be positive");
+    const size_t m = outputs.size(), n = inputs.size();
+    std::vector<double> jac(m * n, 0.0);
+    Tape tape(outputs.roots());
+    std::vector<Node *> columns = inputs.roots();
+
+    for (size_t first=0; first < m; first += lanes) {
+        const size_t k = std::min(lanes, m - first);
+        std::vector<double> seeds(m * k, 0.0);
+        for (size_t l=0; l < k; l++) seeds[(first + l) * k + l] = 1.0;
+        tape.propagate(seeds, k);
+        for (size_t j=0; j < n; j++) {
+            size_t index = tape.index(columns[j]);
+            if (index == tape.size()) continue;
+            for (size_t l=0; l < k; l++) jac[(first + l) * n + j] = tape.adjoint(index, l);
+        }
+    }
+    return jac;
+}
+
 }  // namespace autodiff
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Inlined into the per-instruction-set drivers below, so every helper is
+// compiled with the vector width and target of the driver that calls it.
+// Helpers take and return vectors by reference: a by-value AVX vector in a
+// function compiled without AVX has a different ABI.
+#define AUTODIFF_VMATH_INLINE inline __attribute__((always_inline))
+
+// Vectorized elementary functions over contiguous arrays of doubles, for the
+// elementwise Tensor kernels and the Vector math ops. The kernels are written
+// once with GCC/Clang vector types and compiled for SSE2 (2 lanes), AVX2 with
+// FMA (4) and AVX-512F (8); the widest one the CPU supports is picked at first
+// use. The wider builds may fuse a * b + c, so results can differ in the last
+// bit between them; the bounds below hold for all three.
+//
+// Largest error against glibc, as measured by VectorMathTest:
+//
+//     exp      1 ulp   subnormal results may round twice
+//     log      1 ulp   subnormal arguments included
+//     sin/cos  1 ulp   for |x| <= 10, 2 ulp up to sincos_limit; larger and
+//                      non-finite arguments are passed on to libm
+//     sqrt     0 ulp   the hardware instruction, correctly rounded
+//
+// Special values follow libm: exp(-inf) = 0, exp(inf) = inf, log(0) = -inf,
+// log(x < 0) = NaN, and NaN in gives NaN out; errno is never set.
+namespace autodiff {
+namespace vmath {
+
+enum class Isa { SSE2, AVX2, AVX512 };
+
+inline Isa detect() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Isa::AVX2;
+#endif
+    return Isa::SSE2;
+}
+
+// Instruction set the kernels run with, detected on first use. Tests and
+// benchmarks may lower it to compare widths; raising it above detect() is
+// undefined. Other architectures run the 2-lane kernels as Isa::SSE2.
+inline Isa &isa() {
+    static Isa level = detect();
+    return level;
+}
+
+// Elements per stack buffer for callers that stage values through the kernels
+// a block at a time.
+constexpr size_t block = 256;
+
+// Arguments of larger magnitude make sin and cos fall back to libm.
+constexpr double sincos_limit = 1647099.3291652855;  // 2^20 pi/2
+
+namespace detail {
+
+constexpr double shifter = 6755399441055744.0;  // 1.5 * 2^52
+constexpr double ln2_hi = 6.93147180369123816490e-01;
+constexpr double ln2_lo = 1.90821492927058770002e-10;
+
+// Unsigned 64-bit lanes of the same width as V. Bit operations use these:
+// shifts of unsigned lanes and masks built by and-ing need no instruction
+// that SSE2 or AVX2 lack, unlike arithmetic shifts and 64-bit compares.
+template <class V>
+struct Bits {
+    typedef uint64_t type __attribute__((vector_size(sizeof(V))));
+};
+
+template <class To, class From>
+AUTODIFF_VMATH_INLINE void bitcast(const From &from, To &to) {
+    static_assert(sizeof(To) == sizeof(From), "bitcast between different sizes");
+    std::memcpy(&to, &from, sizeof(to));
+}
+
+template <class V>
+AUTODIFF_VMATH_INLINE void splat(double c, V &out) {
+    out = V{} + c;
+}
+
+template <class V, size_t N, size_t... I>
+AUTODIFF_VMATH_INLINE void horner(const V &z, const double (&c)[N], V &out, std::index_sequence<I...>) {
+    splat(c[N - 1], out);
+    // One step per I, in order: -O2 would keep a loop over c.
+    int steps[] = { 0, (out = out * z + c[N - 2 - I], 0)... };
+    (void)steps;
+}
+
+// c[0] + z * (c[1] + z * (... + z * c[N - 1])), by Horner's rule.
+template <class V, size_t N>
+AUTODIFF_VMATH_INLINE void horner(const V &z, const double (&c)[N], V &out) {
+    horner(z, c, out, std::make_index_sequence<N - 1>());
+}
+
+// e^x = 2^k e^r with k = round(x / ln 2) and |r| <= ln(2) / 2, ln 2 split in
+// two parts (Cody and Waite) so that k ln 2 is subtracted exactly. e^r is its
+// Taylor series to degree 13, whose remainder is below 2^-60. x is clamped
+// to [-746, 710], beyond which the result has under- or overflowed already,
+// so that 2^k applied in two halves stays a normal number.
+template <class V>
+AUTODIFF_VMATH_INLINE void exp(const V &x, V &out) {
+    using U = typename Bits<V>::type;
+    static constexpr double c[] = {
+        1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320, 1.0 / 362880,
+        1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800
+    };
+    V lo, hi, shift;
+    splat(-746.0, lo);
+    splat(710.0, hi);
+    splat(shifter, shift);
+    // Comparisons with NaN are false, so NaN passes the clamp.
+    V xc = x < lo ? lo : x;
+    xc = xc > hi ? hi : xc;
+    // Adding 1.5 * 2^52 rounds to an integer, which the low bits then hold.
+    V t = xc * 1.4426950408889634 + shift;
+    V k = t - shift;
+    V r = (xc - k * ln2_hi) - k * ln2_lo;
+    V p;
+    horner(r, c, p);
+
+    // k >= -1076, so k + 2046 is positive and even-shifted: its half is
+    // floor(k / 2) + 1023, the biased exponent of the first half of 2^k.
+    U kb, bias;
+    bitcast(t, kb);
+    bitcast(shift, bias);
+    kb = kb - bias + 2046;
+    U e1 = kb >> 1;
+    V s1, s2;
+    bitcast(e1 << 52, s1);
+    bitcast((kb - e1) << 52, s2);
+    out = p * s1 * s2;
+}
+
+// log x = e ln 2 + log m with x = m 2^e and m in [sqrt(1/2), sqrt(2)).
+// With f = m - 1 and s = f / (2 + f), log m = 2 atanh(s), written as
+// f - f^2/2 + s (f^2/2 + R) as in fdlibm so that the leading term f is
+// exact; R is the atanh series in s^2 <= 0.0295 to degree 10.
+template <class V>
+AUTODIFF_VMATH_INLINE void log(const V &x, V &out) {
+    using U = typename Bits<V>::type;
+    static constexpr double c[] = {
+        2.0 / 3, 2.0 / 5, 2.0 / 7, 2.0 / 9, 2.0 / 11, 2.0 / 13, 2.0 / 15, 2.0 / 17, 2.0 / 19, 2.0 / 21
+    };
+    // Subnormals are scaled by 2^54 into the normal range first.
+    auto tiny = x < std::numeric_limits<double>::min();
+    V xs = tiny ? x * 18014398509481984.0 : x;
+    U bits;
+    bitcast(xs, bits);
+    // The exponent field becomes a double by taking the place of the low
+    // mantissa bits of 2^52.
+    V e, m;
+    bitcast(((bits >> 52) & 0x7ff) | 0x4330000000000000, e);
+    e = e - (4503599627370496.0 + 1023.0);
+    e = tiny ? e - 54.0 : e;
+    bitcast((bits & 0x000fffffffffffff) | 0x3ff0000000000000, m);
+    auto big = m > 1.4142135623730951;
+    m = big ? m * 0.5 : m;
+    e = big ? e + 1.0 : e;
+
+    V f = m - 1.0;
+    V s = f / (f + 2.0);
+    V z = s * s;
+    V hfsq = 0.5 * f * f;
+    V R;
+    horner(z, c, R);
+    R = R * z;
+    V res = e * ln2_hi - ((hfsq - (s * (hfsq + R) + e * ln2_lo)) - f);
+
+    V zero = {}, nan, inf;
+    splat(std::numeric_limits<double>::quiet_NaN(), nan);
+    splat(std::numeric_limits<double>::infinity(), inf);
+    res = x < zero ? nan : res;
+    res = x == zero ? -inf : res;
+    res = x == inf ? inf : res;
+    out = x != x ? x : res;
+}
+
+// sin x and cos x from one reduction x = k pi/2 + r, |r| <= pi/4, with pi/2
+// split in three 33-bit parts and a tail so that r keeps full relative
+// precision for |k| < 2^20. The Taylor series of sin r to degree 17 and of
+// cos r to degree 18 have remainders below 2^-63; the quadrant k mod 4
+// swaps and negates them. Lanes beyond sincos_limit are left to the caller.
+template <class V>
+AUTODIFF_VMATH_INLINE void sincos(const V &x, V &s, V &c) {
+    using U = typename Bits<V>::type;
+    static constexpr double sc[] = {
+        -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800, 1.0 / 6227020800,
+        -1.0 / 1307674368000, 1.0 / 355687428096000
+    };
+    static constexpr double cc[] = {
+        1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800, 1.0 / 479001600, -1.0 / 87178291200,
+        1.0 / 20922789888000, -1.0 / 6402373705728000
+    };
+    const double pio2_1 = 1.57079632673412561417e+00;
+    const double pio2_2 = 6.07710050630396597660e-11;
+    const double pio2_3 = 2.02226624871116645580e-21;
+    const double pio2_3t = 8.47842766036889956997e-32;
+
+    V shift;
+    splat(shifter, shift);
+    V t = x * 0.63661977236758134 + shift;
+    V k = t - shift;
+    V r = ((x - k * pio2_1) - k * pio2_2) - k * pio2_3;
+    r = r - k * pio2_3t;
+    V z = r * r;
+
+    V ps, pc;
+    horner(z, sc, ps);
+    V sr = r + r * z * ps;
+    // sin(-0) is -0.
+    sr = x == 0.0 ? x : sr;
+    horner(z, cc, pc);
+    // 1 - z/2 rounds away most of z/2; its rounding error is added back.
+    V hz = 0.5 * z;
+    V w = 1.0 - hz;
+    V cr = w + (((1.0 - w) - hz) + z * z * pc);
+
+    // The low bits of t hold k mod 4: odd quadrants swap sin and cos, and
+    // bit 1 of k (of k + 1 for cos) flips the sign.
+    U q, sb, cb;
+    bitcast(t, q);
+    bitcast(sr, sb);
+    bitcast(cr, cb);
+    U odd = 0 - (q & 1);
+    U sq = (cb & odd) | (sb & ~odd);
+    U cq = (sb & odd) | (cb & ~odd);
+    bitcast(sq ^ ((q & 2) << 62), s);
+    bitcast(cq ^ (((q + 1) & 2) << 62), c);
+}
+
+struct Exp {
+    template <class V>
+    static AUTODIFF_VMATH_INLINE void lanes(const V &x, V &a, V &) { exp(x, a); }
+    static bool covered(size_t, const double *) { return true; }
+    static void fix(size_t, const double *, double *, double *) {}
+};
+
+struct Log {
+    template <class V>
+    static AUTODIFF_VMATH_INLINE void lanes(const V &x, V &a, V &) { log(x, a); }
+    static bool covered(size_t, const double *) { return true; }
+    static void fix(size_t, const double *, double *, double *) {}
+};
+
+// a = sin x and b = cos x.
+struct Sin {
+    template <class V>
+    static AUTODIFF_VMATH_INLINE void lanes(const V &x, V &a, V &b) { sincos(x, a, b); }
+    static AUTODIFF_VMATH_INLINE bool covered(size_t n, const double *x) {
+        bool res = true;
+        for (size_t i=0; i < n; i++) res &= std::abs(x[i]) <= sincos_limit;
+        return res;
+    }
+    static void fix(size_t n, const double *x, double *a, double *b) {
+        for (size_t i=0; i < n; i++) {
+            if (std::abs(x[i]) <= sincos_limit) continue;
+            a[i] = std::sin(x[i]);
+            b[i] = std::cos(x[i]);
+        }
+    }
+};
+
+// a = cos x and b = sin x.
+struct Cos {
+    template <class V>
+    static AUTODIFF_VMATH_INLINE void lanes(const V &x, V &a, V &b) { sincos(x, b, a); }
+    static AUTODIFF_VMATH_INLINE bool covered(size_t n, const double *x) { return Sin::covered(n, x); }
+    static void fix(size_t n, const double *x, double *a, double *b) { Sin::fix(n, x, b, a); }
+};
+
+// F over n <= W values of x in one zero-padded vector. Lanes the vector code
+// does not cover are redone by F::fix. x is read before a and b are written,
+// so a may be x; b may be null.
+template <class F, size_t W>
+AUTODIFF_VMATH_INLINE void chunk(size_t n, const double *x, double *a, double *b) {
+    typedef double V __attribute__((vector_size(W * sizeof(double))));
+    V v = {}, va = {}, vb = {};
+    std::memcpy(&v, x, n * sizeof(double));
+    F::lanes(v, va, vb);
+    if (!F::covered(n, x)) {
+        double xs[W], ra[W], rb[W];
+        std::memcpy(xs, &v, sizeof(xs));
+        std::memcpy(ra, &va, sizeof(ra));
+        std::memcpy(rb, &vb, sizeof(rb));
+        F::fix(n, xs, ra, rb);
+        std::memcpy(&va, ra, sizeof(ra));
+        std::memcpy(&vb, rb, sizeof(rb));
+    }
+    std::memcpy(a, &va, n * sizeof(double));
+    if (b) std::memcpy(b, &vb, n * sizeof(double));
+}
+
+template <class F, size_t W>
+AUTODIFF_VMATH_INLINE void run(size_t n, const double *x, double *a, double *b) {
+    size_t i = 0;
+    for (; i + W <= n; i += W) chunk<F, W>(W, x + i, a + i, b ? b + i : nullptr);
+    if (i < n) chunk<F, W>(n - i, x + i, a + i, b ? b + i : nullptr);
+}
+
+template <class F>
+void run_sse2(size_t n, const double *x, double *a, double *b) { run<F, 2>(n, x, a, b); }
+
+#if defined(__x86_64__) || defined(__i386__)
+template <class F>
+__attribute__((target("avx2,fma"))) void run_avx2(size_t n, const double *x, double *a, double *b) {
+    run<F, 4>(n, x, a, b);
+}
+
+template <class F>
+__attribute__((target("avx512f"))) void run_avx512(size_t n, const double *x, double *a, double *b) {
+    run<F, 8>(n, x, a, b);
+}
+
+inline void sqrt_sse2(size_t n, const double *x, double *out) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+    for (; i < n; i++) out[i] = std::sqrt(x[i]);
+}
+
+__attribute__((target("avx2"))) inline void sqrt_avx2(size_t n, const double *x, double *out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(x + i)));
+    for (; i < n; i++) out[i] = std::sqrt(x[i]);
+}
+
+__attribute__((target("avx512f"))) inline void sqrt_avx512(size_t n, const double *x, double *out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm512_storeu_pd(out + i, _mm512_maskz_sqrt_pd(0xff, _mm512_loadu_pd(x + i)));
+    for (; i < n; i++) out[i] = std::sqrt(x[i]);
+}
+#endif
+
+template <class F>
+inline void dispatch(size_t n, const double *x, double *a, double *b) {
+    switch (isa()) {
+#if defined(__x86_64__) || defined(__i386__)
+    case Isa::AVX512:
+        run_avx512<F>(n, x, a, b);
+        break;
+    case Isa::AVX2:
+        run_avx2<F>(n, x, a, b);
+        break;
+#endif
+    default:
+        run_sse2<F>(n, x, a, b);
+        break;
+    }
+}
+
+}  // namespace detail
+
+// out[i] = f(x[i]) for i < n. out may be x itself.
+inline void exp(size_t n, const double *x, double *out) { detail::dispatch<detail::Exp>(n, x, out, nullptr); }
+inline void log(size_t n, const double *x, double *out) { detail::dispatch<detail::Log>(n, x, out, nullptr); }
+inline void sin(size_t n, const double *x, double *out) { detail::dispatch<detail::Sin>(n, x, out, nullptr); }
+inline void cos(size_t n, const double *x, double *out) { detail::dispatch<detail::Cos>(n, x, out, nullptr); }
+
+// s[i] = sin x[i] and c[i] = cos x[i], sharing one argument reduction.
+inline void sincos(size_t n, const double *x, double *s, double *c) {
+    detail::dispatch<detail::Sin>(n, x, s, c);
+}
+
+inline void sqrt(size_t n, const double *x, double *out) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (isa()) {
+    case Isa::AVX512:
+        detail::sqrt_avx512(n, x, out);
+        break;
+    case Isa::AVX2:
+        detail::sqrt_avx2(n, x, out);
+        break;
+    default:
+        detail::sqrt_sse2(n, x, out);
+        break;
+    }
+#else
+    for (size_t i=0; i < n; i++) out[i] = std::sqrt(x[i]);
+#endif
+}
+
+}  // namespace vmath
+}  // namespace autodiff
+
+#undef AUTODIFF_VMATH_INLINE
@@ -2,6 +2,10 @@
 #include <autodiff/autodiff.hpp>
 #include <vector>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
 
 using namespace autodiff;
 
@@ -222,6 +226,944 @@ TEST(AutoDiffTest, GradentValueTest2) {
   }
 }
 
+TEST(AutoDiffTest, SharedSubexpressionTest) {
+  auto a = std::make_shared<IndVarNode>(1.0);
+  std::shared_ptr<Node> y = a;
+  for (int i=0; i < 60; i++) {
+    y = y + y;
+  }
+  y->prop(1.0);
+  EXPECT_NEAR(y->value, std::ldexp(1.0, 60), 1e-10);
+  EXPECT_NEAR(a->grad, std::ldexp(1.0, 60), 1e-10);
+}
+
+TEST(AutoDiffTest, LongChainTest) {
+  // Long enough that recursion in either the sweep or the teardown of the
+  // chain would overflow the stack.
+  auto a = std::make_shared<IndVarNode>(0.5);
+  std::shared_ptr<Node> y = a;
+  for (int i=0; i < 1000000; i++) {
+    y = y * 1.0 + 0.0;
+  }
+  y->prop(1.0);
+  EXPECT_NEAR(y->value, 0.5, 1e-10);
+  EXPECT_NEAR(a->grad, 1.0, 1e-10);
+  y.reset();
+  EXPECT_EQ(a.use_count(), 1);
+}
+
+TEST(AutoDiffTest, GradentSharedLeafTest) {
+  Vector a(2); a[0] = 3.0; a[1] = 4.0;
+  Vector o(2); o[0] = a[0] * a[0]; o[1] = a[1] * a[0];
+
+  o.backward();
+
+  std::vector<double> testA = a.grad();
+  EXPECT_NEAR(testA[0], 2 * 3.0 + 4.0, 1e-10);
+  EXPECT_NEAR(testA[1], 3.0, 1e-10);
+}
+
+TEST(AutoDiffTest, GraphArenaTest) {
+  auto a = std::make_shared<IndVarNode>(2.0);
+  auto b = std::make_shared<IndVarNode>(3.0);
+  {
+    GraphArena arena;
+    auto o = exp(a * b + 1.0) / b;
+    EXPECT_EQ(GraphArena::current(), &arena);
+    // mul, add with the constant inline, exp, div
+    EXPECT_EQ(arena.allocations(), 4u);
+    o->prop(1.0);
+    EXPECT_NEAR(o->value, std::exp(7.0) / 3.0, 1e-8);
+    EXPECT_NEAR(a->grad, std::exp(7.0), 1e-8);
+    EXPECT_NEAR(b->grad, 2.0 * std::exp(7.0) / 3.0 - std::exp(7.0) / 9.0, 1e-8);
+  }
+  EXPECT_EQ(GraphArena::current(), nullptr);
+}
+
+TEST(AutoDiffTest, TensorGradientTest) {
+  Tensor a(std::vector<double>{ 1.0, 1.0, 0.5 });
+  Tensor b(std::vector<double>{ 2.0, 2.0, 3.0 });
+  Tensor c(std::vector<double>{ M_PI, M_PI, 0.0 });
+
+  Tensor o = (a * b + c.sin()).exp().log();
+  o.backward();
+
+  std::vector<double> goldensA { 2.0, 2.0, 3.0 };
+  std::vector<double> goldensB { 1.0, 1.0, 0.5 };
+  std::vector<double> goldensC { -1.0, -1.0, 1.0 };
+  for (size_t i=0; i < o.size(); i++) {
+    EXPECT_NEAR(o.values()[i], a.values()[i] * b.values()[i] + std::sin(c.values()[i]), 1e-10);
+    EXPECT_NEAR(a.grad()[i], goldensA[i], 1e-10);
+    EXPECT_NEAR(b.grad()[i], goldensB[i], 1e-10);
+    EXPECT_NEAR(c.grad()[i], goldensC[i], 1e-10);
+  }
+}
+
+TEST(AutoDiffTest, TensorMatchesVectorTest) {
+  std::vector<double> xs { 0.3, 1.7, 2.9, 4.1 };
+  std::vector<double> ys { 1.1, 0.4, 2.2, 0.9 };
+  Tensor ta(xs), tb(ys);
+  Vector va(xs), vb(ys);
+
+  Tensor to = (ta / tb).tan() - 2.0 * ta.cos() + (3.0 / tb).sqrt() * (tb - 5.0).abs() - ta * ta;
+  Vector vo = (va / vb).tan() - 2.0 * va.cos() + (3.0 / vb).sqrt() * (vb - 5.0).abs() - va * va;
+  to.backward();
+  vo.backward();
+
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_NEAR(to.values()[i], vo.values()[i], 1e-10);
+    EXPECT_NEAR(ta.grad()[i], va.grad()[i], 1e-10);
+    EXPECT_NEAR(tb.grad()[i], vb.grad()[i], 1e-10);
+  }
+}
+
+TEST(AutoDiffTest, DualMatchesReverseTest) {
+  auto f = [](const auto &x, const auto &y) {
+    return sin(x * y) + exp(x) / y - sqrt(abs(y)) * tan(x) + log(y) * cos(x) - 2.0 / x;
+  };
+
+  Dual<2> x = Dual<2>::variable(0.7, 0);
+  Dual<2> y = Dual<2>::variable(1.3, 1);
+  Dual<2> o = f(x, y);
+
+  auto a = std::make_shared<IndVarNode>(0.7);
+  auto b = std::make_shared<IndVarNode>(1.3);
+  std::shared_ptr<Node> a_node = a, b_node = b;
+  auto r = f(a_node, b_node);
+  r->prop(1.0);
+
+  EXPECT_NEAR(o.value, r->value, 1e-12);
+  EXPECT_NEAR(o.tangent[0], a->grad, 1e-12);
+  EXPECT_NEAR(o.tangent[1], b->grad, 1e-12);
+}
+
+TEST(AutoDiffTest, ExpressionTemplateTest) {
+  auto f = [](const auto &a, const auto &b, const auto &c) {
+    return a * b + sin(c) * exp(a) - sqrt(abs(b)) / 2.0 + 1.0 / (tan(c) - log(b)) - (-c);
+  };
+
+  Variable a(0.4), b(2.5), c(1.1);
+  Variable plain;
+  plain = f(a, b, c);
+  std::shared_ptr<Node> fused = f(expr::ref(a), b, c);
+
+  EXPECT_EQ(fused->arity(), 7u);
+  EXPECT_NEAR(fused->value, plain.values(), 1e-12);
+
+  plain.VarNodePtr->prop(1.0);
+  std::vector<double> grads;
+  for (Variable *v : { &a, &b, &c }) {
+    grads.push_back(v->VarNodePtr->getGradient());
+    v->VarNodePtr->setGradient(0.0);
+  }
+  fused->prop(1.0);
+  EXPECT_NEAR(a.VarNodePtr->getGradient(), grads[0], 1e-12);
+  EXPECT_NEAR(b.VarNodePtr->getGradient(), grads[1], 1e-12);
+  EXPECT_NEAR(c.VarNodePtr->getGradient(), grads[2], 1e-12);
+}
+
+TEST(AutoDiffTest, ParallelBackwardTest) {
+  ThreadPool::set_num_threads(4);
+  std::vector<double> xs, ys;
+  for (int i=0; i < 1000; i++) {
+    xs.push_back(0.01 * i + 0.5);
+    ys.push_back(1.0 + 0.003 * i);
+  }
+
+  for (bool deterministic : { true, false }) {
+    Vector a(xs), b(ys), pa(xs), pb(ys);
+    Vector o = (a * b + a.sin()).exp().log() / b;
+    Vector po = (pa * pb + pa.sin()).exp().log() / pb;
+    o[7] = o[7] * a[3] + b[999];
+    po[7] = po[7] * pa[3] + pb[999];
+
+    o.backward();
+    po.backward_parallel(deterministic);
+
+    std::vector<double> ga = a.grad(), gb = b.grad(), pga = pa.grad(), pgb = pb.grad();
+    for (size_t i=0; i < xs.size(); i++) {
+      if (deterministic) {
+        EXPECT_EQ(ga[i], pga[i]);
+        EXPECT_EQ(gb[i], pgb[i]);
+      } else {
+        EXPECT_NEAR(ga[i], pga[i], 1e-12);
+        EXPECT_NEAR(gb[i], pgb[i], 1e-12);
+      }
+    }
+  }
+  ThreadPool::set_num_threads(std::thread::hardware_concurrency());
+}
+
+TEST(AutoDiffTest, ThreadPoolResizeTest) {
+  // Loops on the global pool from several threads while it is resized; the
+  // pool reference stays valid and every loop still covers its whole range.
+  std::vector<std::thread> threads;
+  std::vector<size_t> sums(4, 0);
+  for (size_t t=0; t < sums.size(); t++) {
+    threads.emplace_back([&sums, t] {
+      for (int round=0; round < 50; round++) {
+        std::vector<size_t> hits(64, 0);
+        ThreadPool::instance().parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+        for (size_t h : hits) sums[t] += h;
+      }
+    });
+  }
+  for (size_t n : { 2, 5, 1, 3 }) ThreadPool::set_num_threads(n);
+  for (std::thread &thread : threads) thread.join();
+  for (size_t sum : sums) EXPECT_EQ(sum, 50u * 64u);
+  EXPECT_EQ(ThreadPool::instance().size(), 3u);
+  ThreadPool::set_num_threads(std::thread::hardware_concurrency());
+}
+
+TEST(AutoDiffTest, ParallelForwardTest) {
+  std::vector<double> xs;
+  for (int i=0; i < 500; i++) xs.push_back(0.01 * i + 0.5);
+
+  Vector a(xs), pa(xs);
+  Vector o = (a * 2.0 + a.sin()).exp().log() / a;
+  o.backward();
+
+  ThreadPool::set_num_threads(4);
+  size_t threshold = parallel_threshold();
+  parallel_threshold() = 16;
+  {
+    GraphArena arena;
+    Vector po = (pa * 2.0 + pa.sin()).exp().log() / pa;
+    EXPECT_EQ(arena.allocations(), 6 * xs.size());
+    po.backward();
+    for (size_t i=0; i < xs.size(); i++) {
+      EXPECT_EQ(o.getitem(i), po.getitem(i));
+      EXPECT_EQ(a.grad()[i], pa.grad()[i]);
+    }
+  }
+  parallel_threshold() = threshold;
+  ThreadPool::set_num_threads(std::thread::hardware_concurrency());
+}
+
+TEST(AutoDiffTest, BackwardManyTest) {
+  ThreadPool::set_num_threads(3);
+  std::vector<double> xs { 0.5, 1.5, 2.5 };
+  Vector a(xs), b(xs), sa(xs), sb(xs);
+
+  Vector p = a.sin() * b, q = (a + 1.0).log(), r = b.exp();
+  Vector sp = sa.sin() * sb, sq = (sa + 1.0).log(), sr = sb.exp();
+  backward_many({ &p, &q, &r });
+  sp.backward();
+  sq.backward();
+  sr.backward();
+
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_EQ(a.grad()[i], sa.grad()[i]);
+    EXPECT_EQ(b.grad()[i], sb.grad()[i]);
+  }
+  ThreadPool::set_num_threads(std::thread::hardware_concurrency());
+}
+
+TEST(AutoDiffTest, ProfileStatsTest) {
+  reset_stats();
+  Variable a = 2.0;
+  std::shared_ptr<Node> s = sin(a);
+  std::shared_ptr<Node> y = s * s + s;
+  y->prop(1.0);
+
+  // Counters only move in builds with AUTODIFF_PROFILE.
+  const uint64_t on = profiling_enabled ? 1 : 0;
+  Stats st = stats();
+  EXPECT_EQ(st.created(OpCode::Variable), on);
+  EXPECT_EQ(st.created(OpCode::Sin), on);
+  EXPECT_EQ(st.created(OpCode::Mul), on);
+  EXPECT_EQ(st.created(OpCode::Add), on);
+  EXPECT_EQ(st.recorded, 4 * on);
+  // s is reached from three operand slots.
+  EXPECT_EQ(st.visited, 6 * on);
+  EXPECT_EQ(st.swept, 4 * on);
+  EXPECT_EQ(st.bytes > 0, profiling_enabled);
+
+  reset_stats();
+  EXPECT_EQ(stats().recorded, 0u);
+}
+
+TEST(AutoDiffTest, CompiledFunctionTest) {
+  auto formula = [](Vector &a, Vector &b) {
+    return a.sin() + b.cos() + a * 5 - (b + 2) / a.exp();
+  };
+  std::vector<double> xa { 0.1, 0.2, 0.3 }, xb { 1.5, 2.5, 3.5 };
+  Vector a(xa), b(xb);
+  CompiledFunction f({ &a, &b }, formula(a, b));
+  EXPECT_EQ(f.inputs(), 6u);
+  EXPECT_EQ(f.outputs(), 3u);
+
+  std::vector<double> ya { -0.4, 0.7, 1.2 }, yb { 0.5, -1.5, 2.0 };
+  Vector c(ya), d(yb);
+  Vector expect = formula(c, d);
+  expect.backward();
+
+  std::vector<double> x(ya);
+  x.insert(x.end(), yb.begin(), yb.end());
+  std::vector<double> y = f.forward(x);
+  std::vector<double> grad = f.backward(std::vector<double>(3, 1.0));
+  for (size_t i=0; i < 3; i++) {
+    EXPECT_NEAR(y[i], expect.values()[i], 1e-10);
+    EXPECT_NEAR(grad[i], c.grad()[i], 1e-10);
+    EXPECT_NEAR(grad[3 + i], d.grad()[i], 1e-10);
+  }
+}
+
+TEST(AutoDiffTest, CompiledBackwardFirstTest) {
+  std::vector<double> xs { 0.4, -1.1, 2.3 };
+  Vector a(xs);
+  CompiledFunction f({ &a }, a.sin() + a.cos());
+  std::vector<double> grad = f.backward(std::vector<double>(3, 1.0));
+  for (size_t i=0; i < 3; i++) EXPECT_DOUBLE_EQ(grad[i], std::cos(xs[i]) - std::sin(xs[i]));
+}
+
+struct UnknownOpNode: Node {
+  std::shared_ptr<Node> m;
+  explicit UnknownOpNode(const std::shared_ptr<Node> &m): Node(m->value), m(m) {}
+  size_t arity() const override { return 1; }
+  Node *operand(size_t) const override { return m.get(); }
+};
+
+TEST(AutoDiffTest, CompiledUnsupportedTest) {
+  std::vector<double> xs { 0.5, 1.5 };
+  Vector a(xs);
+  Vector c = checkpoint_steps([](Vector &x) { return x.sin(); }, a, 4, 1);
+  EXPECT_THROW(CompiledFunction({ &a }, c), std::runtime_error);
+
+  Variable x(0.5);
+  auto y = std::make_shared<UnknownOpNode>(x.VarNodePtr);
+  EXPECT_THROW(CompiledFunction({ x.VarNodePtr.get() }, { y.get() }), std::runtime_error);
+}
+
+TEST(AutoDiffTest, VectorJacobianTest) {
+  std::vector<double> xs { 0.5, 1.5, 2.5 };
+  Vector a(xs);
+  Vector o(3);
+  o[0] = a[0] * a[1];
+  o[1] = sin(a[2]);
+  o[2] = a[0] + a[2] * a[2];
+
+  // J = [[x1, x0, 0], [0, 0, cos x2], [1, 0, 2 x2]]
+  std::vector<double> expect { xs[1], xs[0], 0.0, 0.0, 0.0, std::cos(xs[2]), 1.0, 0.0, 2 * xs[2] };
+  for (size_t lanes : { 1, 2, 32 }) {
+    std::vector<double> jac = jacobian(o, a, lanes);
+    for (size_t i=0; i < expect.size(); i++) {
+      EXPECT_NEAR(jac[i], expect[i], 1e-10);
+    }
+  }
+  EXPECT_THROW(jacobian(o, a, 0), std::runtime_error);
+  EXPECT_EQ(a.grad()[0], 0.0);
+
+  o.backward({ 2.0, 0.0, -1.0 });
+  std::vector<double> grad = a.grad();
+  EXPECT_NEAR(grad[0], 2 * xs[1] - 1.0, 1e-10);
+  EXPECT_NEAR(grad[1], 2 * xs[0], 1e-10);
+  EXPECT_NEAR(grad[2], -2 * xs[2], 1e-10);
+}
+
+TEST(AutoDiffTest, RetainedGraphTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 };
+  Vector p(xs);
+  Vector loss = (p * p).sin() + p;
+  loss.retain();
+  Node *leaf = p[0].VarNodePtr.get();
+
+  for (int step=0; step < 3; step++) {
+    for (double &x : xs) x -= 0.1;
+    p.set_values(xs);
+    loss.forward();
+    p.zero_grad();
+    loss.backward();
+
+    std::vector<double> grad = p.grad();
+    for (size_t i=0; i < xs.size(); i++) {
+      EXPECT_NEAR(loss.values()[i], std::sin(xs[i] * xs[i]) + xs[i], 1e-10);
+      EXPECT_NEAR(grad[i], 2 * xs[i] * std::cos(xs[i] * xs[i]) + 1.0, 1e-10);
+    }
+  }
+  EXPECT_EQ(p[0].VarNodePtr.get(), leaf);
+  EXPECT_THROW(loss.set_values(xs), std::runtime_error);
+}
+
+TEST(AutoDiffTest, RetainedReplacedElementTest) {
+  // Assigning through operator() drops the old root; the retained tape must
+  // neither read it nor keep retain mode.
+  std::vector<double> xs { 0.5, 1.0 };
+  Vector a(xs);
+  Vector q = a.sin();
+  q.retain();
+  q(0) = 5.0;
+  EXPECT_FALSE(q.retained());
+  EXPECT_THROW(q.forward(), std::runtime_error);
+  q.backward();
+  EXPECT_NEAR(a.grad()[0], 0.0, 1e-10);
+  EXPECT_NEAR(a.grad()[1], std::cos(1.0), 1e-10);
+}
+
+TEST(AutoDiffTest, ConstOperandTest) {
+  auto x = std::make_shared<IndVarNode>(2.0);
+  std::vector<std::shared_ptr<Node>> ys { x + 3.0, 3.0 + x, x - 3.0, 3.0 - x, x * 3.0, 3.0 * x, x / 3.0, 3.0 / x };
+  std::vector<double> values { 5.0, 5.0, -1.0, 1.0, 6.0, 6.0, 2.0 / 3.0, 1.5 };
+  std::vector<double> partials { 1.0, 1.0, 1.0, -1.0, 3.0, 3.0, 1.0 / 3.0, -0.75 };
+  for (size_t i=0; i < ys.size(); i++) {
+    EXPECT_EQ(ys[i]->arity(), 1u);
+    EXPECT_NEAR(ys[i]->value, values[i], 1e-10);
+    x->grad = 0.0;
+    ys[i]->prop(1.0);
+    EXPECT_NEAR(x->grad, partials[i], 1e-10);
+  }
+
+  // Vector elements are the op nodes themselves.
+  Vector a(2);
+  Vector o = a * 2.0;
+  EXPECT_EQ(o[0].VarNodePtr->opcode(), OpCode::MulConst);
+  EXPECT_EQ(o[0].VarNodePtr->operand(0), a[0].VarNodePtr.get());
+}
+
+TEST(AutoDiffTest, FlatMatchesNodeTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 }, ys { 2.0, 0.25, 3.0 };
+  Vector a(xs), b(ys);
+  Vector o = (a.sin() * b + 2.0).exp() / (b - a.cos()) + (a / 3.0).sqrt() - 1.0 / b.abs();
+  o.backward();
+
+  flat::Graph graph;
+  flat::Vector fa(xs), fb(ys);
+  size_t leaves = graph.size();
+  for (int step=0; step < 2; step++) {
+    flat::Vector fo = (fa.sin() * fb + 2.0).exp() / (fb - fa.cos()) + (fa / 3.0).sqrt() - 1.0 / fb.abs();
+    fo.backward();
+    for (size_t i=0; i < xs.size(); i++) {
+      EXPECT_EQ(fo.getitem(i), o.getitem(i));
+      EXPECT_NEAR(fa.grad()[i], (step + 1) * a.grad()[i], 1e-10);
+      EXPECT_NEAR(fb.grad()[i], (step + 1) * b.grad()[i], 1e-10);
+    }
+    graph.rewind(leaves);
+  }
+  EXPECT_EQ(graph.size(), 6u);
+}
+
+TEST(AutoDiffTest, FlatRetainTest) {
+  // The same retained training loop, written once, on both engines.
+  auto f = [](auto &p) { return ((p * p).sin() + 1.0 - p) * 2.0 / (3.0 - p).tan() + 0.5 / p.exp().log().abs(); };
+  auto run = [&](auto &p, std::vector<double> xs) {
+    auto loss = f(p);
+    loss.retain();
+    for (int step=0; step < 3; step++) {
+      for (double &x : xs) x -= 0.1;
+      p.set_values(xs);
+      loss.forward();
+      p.zero_grad();
+      loss.backward(std::vector<double>(xs.size(), 2.0));
+    }
+    auto res = std::make_pair(loss.values(), p.grad());
+    EXPECT_TRUE(loss.retained());
+    EXPECT_THROW(loss.set_values(xs), std::runtime_error);
+    loss.setitem(0, 1.0);
+    EXPECT_FALSE(loss.retained());
+    return res;
+  };
+
+  std::vector<double> xs { 0.5, 1.0, 1.5 };
+  Vector p(xs);
+  auto node = run(p, xs);
+  flat::Graph graph;
+  flat::Vector fp(xs);
+  auto replayed = run(fp, xs);
+
+  // A graph built on the final values from scratch.
+  std::vector<double> last = xs;
+  for (int step=0; step < 3; step++) {
+    for (double &x : last) x -= 0.1;
+  }
+  flat::Vector fresh(last);
+  flat::Vector o = f(fresh);
+  o.backward(std::vector<double>(last.size(), 2.0));
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_EQ(replayed.first[i], o.getitem(i));
+    EXPECT_EQ(replayed.second[i], fresh.grad()[i]);
+    EXPECT_NEAR(node.first[i], replayed.first[i], 1e-12);
+    EXPECT_NEAR(node.second[i], replayed.second[i], 1e-12);
+  }
+}
+
+TEST(AutoDiffTest, FlatSetitemTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 };
+  flat::Graph graph;
+  flat::Vector v(xs);
+  flat::Graph other;
+  v.setitem(1, 4.0);
+  EXPECT_EQ(other.size(), 0u);
+
+  flat::Vector o = v * v;
+  o.backward();
+  EXPECT_EQ(o.getitem(1), 16.0);
+  EXPECT_EQ(v.grad()[1], 8.0);
+  EXPECT_EQ(v.grad()[2], 3.0);
+}
+
+TEST(AutoDiffTest, FlatPrecisionTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 }, ys { 2.0, 0.25, 3.0 };
+  std::vector<float> xf(xs.begin(), xs.end()), yf(ys.begin(), ys.end());
+  auto f = [](auto &a, auto &b) { return (a.sin() * b + 2.0).exp() / (b - a.cos()) + (a / 3.0).sqrt(); };
+
+  flat::Graph graph;
+  flat::Vector a(xs), b(ys);
+  flat::Vector o = f(a, b);
+  o.backward();
+
+  flat::Graph32 graph32;
+  flat::Vector32 a32(xf), b32(yf);
+  flat::Vector32 o32 = f(a32, b32);
+  o32.backward();
+
+  flat::MixedGraph mixed;
+  flat::MixedVector am(xf), bm(yf);
+  flat::MixedVector om = f(am, bm);
+  om.backward();
+
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_NEAR(o32.getitem(i), o.getitem(i), 1e-5 * std::abs(o.getitem(i)));
+    EXPECT_EQ(om.getitem(i), o32.getitem(i));
+    EXPECT_NEAR(a32.grad()[i], a.grad()[i], 1e-5 * std::abs(a.grad()[i]));
+    EXPECT_NEAR(bm.grad()[i], b.grad()[i], 1e-5 * std::abs(b.grad()[i]));
+  }
+  EXPECT_LT(sizeof(flat::Record<float>), sizeof(flat::Record<double>));
+
+  // A leaf used 2^18 times: float adjoints drift by about 1%, double
+  // accumulators of the same float partials do not.
+  const size_t n = 1 << 18;
+  auto uses = [&](auto &g) {
+    uint32_t x = g.leaf(1.0f);
+    std::vector<uint32_t> roots(n);
+    for (size_t i=0; i < n; i++) roots[i] = g.push(OpCode::MulConst, x, 0, 0.1f, 0.1f, 0.0f);
+    using G = typename std::decay_t<decltype(g)>::grad_type;
+    g.backward(roots.data(), std::vector<G>(n, G(1)).data(), n);
+    return static_cast<double>(g.grad(x));
+  };
+  flat::Graph32 g32;
+  flat::MixedGraph gm;
+  EXPECT_GT(std::abs(uses(g32) - 0.1 * n), 1e-3 * n * 0.1);
+  EXPECT_NEAR(uses(gm), static_cast<double>(0.1f) * n, 1e-6 * n);
+}
+
+TEST(AutoDiffTest, HessianTest) {
+  auto f = [](Vector &x) {
+    Vector o(3);
+    o[0] = x[0] * x[1] + sin(x[0]) * exp(x[2]);
+    o[1] = x[1] / x[2] + tan(x[1]) * log(x[2]);
+    o[2] = sqrt(x[0]) * cos(x[1]) + 2.0 / x[0] - (x[2] * 3.0 + 1.0) * x[2];
+    return o;
+  };
+  auto gradient = [&](std::vector<double> xs) {
+    Vector x(xs);
+    f(x).backward();
+    return x.grad();
+  };
+
+  std::vector<double> xs { 0.7, 0.4, 1.3 };
+  Vector x(xs);
+  Vector o = f(x);
+  std::vector<double> h = hessian(o, x);
+
+  // Central differences of the exact gradient.
+  const double eps = 1e-5;
+  for (size_t j=0; j < xs.size(); j++) {
+    std::vector<double> up(xs), down(xs);
+    up[j] += eps;
+    down[j] -= eps;
+    std::vector<double> gu = gradient(up), gd = gradient(down);
+    for (size_t i=0; i < xs.size(); i++) {
+      EXPECT_NEAR(h[i * 3 + j], (gu[i] - gd[i]) / (2 * eps), 1e-6);
+    }
+  }
+
+  std::vector<double> v { 0.5, -1.0, 2.0 };
+  std::vector<double> hv = hvp(o, x, v);
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_NEAR(hv[i], h[i * 3] * v[0] + h[i * 3 + 1] * v[1] + h[i * 3 + 2] * v[2], 1e-10);
+  }
+}
+
+TEST(AutoDiffTest, SparseJacobianTest) {
+  const size_t n = 10;
+  std::vector<double> xs(n);
+  for (size_t i=0; i < n; i++) xs[i] = 0.1 * i + 0.3;
+  Vector x(xs);
+  Vector o(n);
+  for (size_t i=0; i < n; i++) {
+    o[i] = i ? x[i - 1] * x[i] : x[0] * 2.0;
+    if (i + 1 < n) o[i] = o[i] + sin(x[i + 1]);
+  }
+
+  // Tridiagonal: rows within two of each other share a column.
+  SparseJacobian sj(o, x);
+  EXPECT_EQ(sj.colors(), 3);
+  EXPECT_EQ(sj.pattern().indices.size(), 3 * n - 2);
+  std::vector<double> dense = jacobian(o, x);
+  for (size_t lanes : { 1, 2, 16 }) {
+    SparseMatrix jac = sj.evaluate(lanes);
+    EXPECT_EQ(jac.nonzeros(), 3 * n - 2);
+    std::vector<double> d = jac.dense();
+    for (size_t i=0; i < d.size(); i++) {
+      EXPECT_NEAR(d[i], dense[i], 1e-12);
+    }
+  }
+
+  // The same leaf as two inputs fills both columns.
+  Vector in(2);
+  in[0] = x[1];
+  in[1] = x[1];
+  SparseMatrix twice = sparse_jacobian(o, in);
+  EXPECT_EQ(twice.nonzeros(), 6);
+  EXPECT_NEAR(twice.dense()[0], std::cos(xs[1]), 1e-12);
+  EXPECT_NEAR(twice.dense()[1], std::cos(xs[1]), 1e-12);
+}
+
+TEST(AutoDiffTest, CheckpointTest) {
+  Segment step = [](Vector &x) { return x.sin() * 0.9 + x * x * 0.05; };
+  std::vector<double> xs { 0.3, -0.8, 1.2, 0.5 };
+  const size_t steps = 40;
+
+  Vector plain(xs);
+  Vector y = plain;
+  for (size_t i=0; i < steps; i++) y = step(y);
+  y.backward({ 1.0, -2.0, 0.5, 3.0 });
+  std::vector<double> values = y.values(), grad = plain.grad();
+
+  for (size_t budget : { 0, 1, 8, 1000 }) {
+    Vector x(xs);
+    Vector z = checkpoint_steps(step, x, steps, budget);
+    z.backward({ 1.0, -2.0, 0.5, 3.0 });
+    std::vector<double> zv = z.values(), zg = x.grad();
+    for (size_t i=0; i < xs.size(); i++) {
+      EXPECT_NEAR(zv[i], values[i], 1e-12);
+      EXPECT_NEAR(zg[i], grad[i], 1e-12);
+    }
+  }
+
+  // A segment whose outputs are only partly used, reached through two paths.
+  Vector x(xs);
+  Vector c = checkpoint([](Vector &v) { return v.exp() * v; }, x);
+  Variable loss = c[0] * c[1] + c[1];
+  loss.VarNodePtr->prop(1.0);
+  std::vector<double> g = x.grad();
+  const double c0 = std::exp(xs[0]) * xs[0], c1 = std::exp(xs[1]) * xs[1];
+  EXPECT_NEAR(g[0], c1 * std::exp(xs[0]) * (1 + xs[0]), 1e-12);
+  EXPECT_NEAR(g[1], (c0 + 1) * std::exp(xs[1]) * (1 + xs[1]), 1e-12);
+  EXPECT_EQ(g[2], 0.0);
+}
+
+TEST(AutoDiffTest, ParallelCheckpointTest) {
+  // Outputs of one segment split across threads, or across backward_many
+  // outputs, must not sweep the segment concurrently.
+  ThreadPool::set_num_threads(4);
+  Segment step = [](Vector &v) { return v.sin() * v; };
+  std::vector<double> xs { 0.3, -0.8, 1.2, 0.5, 0.9, -0.1, 0.7, 1.5 };
+  std::vector<double> expect(xs.size());
+  for (size_t i=0; i < xs.size(); i++) expect[i] = std::cos(xs[i]) * xs[i] + std::sin(xs[i]);
+
+  for (bool deterministic : { true, false }) {
+    Vector x(xs);
+    Vector y = checkpoint(step, x);
+    y.backward_parallel(deterministic);
+    for (size_t i=0; i < xs.size(); i++) EXPECT_NEAR(x.grad()[i], expect[i], 1e-12);
+  }
+
+  Vector x(xs);
+  Vector y = checkpoint(step, x);
+  Vector p = y * 1.0, q = y * 2.0;
+  backward_many({ &p, &q });
+  for (size_t i=0; i < xs.size(); i++) EXPECT_NEAR(x.grad()[i], 3.0 * expect[i], 1e-12);
+  ThreadPool::set_num_threads(std::thread::hardware_concurrency());
+}
+
+TEST(AutoDiffTest, VectorOwnershipTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 };
+  Vector a(xs);
+  std::weak_ptr<Node> temporary, inner;
+  {
+    Vector t = (a * a + a.sin()).exp();
+    temporary = t[0].VarNodePtr;
+    Vector copy = t;
+    copy[0] = 2.0;
+    EXPECT_NEAR(t.getitem(0), std::exp(0.25 + std::sin(0.5)), 1e-12);
+    Vector moved = std::move(t);
+    EXPECT_EQ(t.size(), 0);
+    EXPECT_EQ(moved[0].VarNodePtr, temporary.lock());
+  }
+  EXPECT_TRUE(temporary.expired());
+
+  // A checkpoint keeps its segment's graph only while it runs.
+  Vector c = checkpoint([&](Vector &v) {
+    Vector e = v.exp();
+    inner = e[0].VarNodePtr;
+    return e * v;
+  }, a);
+  EXPECT_TRUE(inner.expired());
+  c.backward();
+  EXPECT_NEAR(a.grad()[1], std::exp(1.0) * 2.0, 1e-12);
+}
+
+TEST(AutoDiffTest, InPlaceTest) {
+  std::vector<double> xs { 0.5, 1.0, 1.5 };
+  Vector a(xs), b(xs);
+  Vector y = a * 2.0;
+  y += b;
+  y *= a;
+  y -= 1.0;
+  y /= b;
+  y.sin_().exp_();
+  y.backward();
+
+  Vector c(xs), d(xs);
+  Vector z = ((((c * 2.0 + d) * c) - 1.0) / d).sin().exp();
+  z.backward();
+  std::vector<double> ga = a.grad(), gb = b.grad(), gc = c.grad(), gd = d.grad();
+  for (size_t i=0; i < xs.size(); i++) {
+    EXPECT_NEAR(y.getitem(i), z.getitem(i), 1e-12);
+    EXPECT_NEAR(ga[i], gc[i], 1e-12);
+    EXPECT_NEAR(gb[i], gd[i], 1e-12);
+  }
+
+  // In place on itself reads every element before replacing it.
+  Vector e(xs);
+  Vector f = e;
+  f += f;
+  f.backward();
+  EXPECT_EQ(e.getitem(0), 0.5);
+  EXPECT_EQ(e.grad()[0], 2.0);
+}
+
+TEST(AutoDiffTest, ReductionTest) {
+  const size_t n = 1000;
+  std::vector<double> xs(n), ys(n);
+  for (size_t i=0; i < n; i++) {
+    xs[i] = std::sin(0.1 * i);
+    ys[i] = 0.5 + 0.001 * i;
+  }
+  Vector a(xs), b(ys);
+  double sum = 0.0, dot = 0.0, sq = 0.0;
+  for (size_t i=0; i < n; i++) {
+    sum += xs[i];
+    dot += xs[i] * ys[i];
+    sq += xs[i] * xs[i];
+  }
+
+  Variable s = a.sum();
+  EXPECT_EQ(s.VarNodePtr->arity(), n);
+  EXPECT_EQ(Tape({ s.VarNodePtr.get() }).size(), n + 1);
+  EXPECT_NEAR(s.values(), sum, 1e-10);
+  EXPECT_NEAR(a.mean().values(), sum / n, 1e-12);
+  EXPECT_NEAR(a.dot(b).values(), dot, 1e-10);
+  EXPECT_NEAR(a.norm2().values(), std::sqrt(sq), 1e-10);
+
+  Vector loss(1);
+  loss[0] = a.sum() + a.mean() * 2.0 + a.dot(b) * 0.5 + a.norm2();
+  loss.backward();
+  std::vector<double> ga = a.grad(), gb = b.grad();
+  for (size_t i=0; i < n; i++) {
+    EXPECT_NEAR(ga[i], 1.0 + 2.0 / n + 0.5 * ys[i] + xs[i] / std::sqrt(sq), 1e-12);
+    EXPECT_NEAR(gb[i], 0.5 * xs[i], 1e-12);
+  }
+
+  CompiledFunction f({ &a, &b }, loss);
+  std::vector<double> x(xs);
+  x.insert(x.end(), ys.begin(), ys.end());
+  EXPECT_NEAR(f.forward(x)[0], loss.getitem(0), 1e-10);
+  std::vector<double> grad = f.backward({ 1.0 });
+  for (size_t i=0; i < n; i++) {
+    EXPECT_NEAR(grad[i], ga[i], 1e-12);
+    EXPECT_NEAR(grad[n + i], gb[i], 1e-12);
+  }
+
+  // Hessian of the norm: (I - x x^T / r^2) / r.
+  std::vector<double> ps { 0.6, -0.8, 1.5 };
+  Vector p(ps);
+  Vector r(1);
+  r[0] = p.norm2();
+  std::vector<double> h = hessian(r, p);
+  const double rr = r.getitem(0);
+  for (size_t i=0; i < 3; i++) {
+    for (size_t j=0; j < 3; j++) {
+      EXPECT_NEAR(h[i * 3 + j], ((i == j) - ps[i] * ps[j] / (rr * rr)) / rr, 1e-12);
+    }
+  }
+}
+
+TEST(AutoDiffTest, GemmTest) {
+  // Sizes off the block edges, in every transpose combination.
+  const size_t m = 133, n = 270, k = 141;
+  std::vector<double> a(m * k), b(k * n);
+  for (size_t i=0; i < a.size(); i++) a[i] = std::sin(0.37 * i);
+  for (size_t i=0; i < b.size(); i++) b[i] = std::cos(0.11 * i);
+  for (bool ta : { false, true }) {
+    for (bool tb : { false, true }) {
+      std::vector<double> c(m * n, 1.0);
+      kernels::gemm(ta, tb, m, n, k, a.data(), b.data(), c.data());
+      for (size_t i=0; i < m; i += 7) {
+        for (size_t j=0; j < n; j += 5) {
+          double expect = 1.0;
+          for (size_t p=0; p < k; p++) {
+            expect += (ta ? a[p * m + i] : a[i * k + p]) * (tb ? b[j * k + p] : b[p * n + j]);
+          }
+          EXPECT_NEAR(c[i * n + j], expect, 1e-10);
+        }
+      }
+    }
+  }
+}
+
+TEST(AutoDiffTest, MatrixTest) {
+  const size_t m = 5, k = 4, n = 3;
+  std::vector<double> av(m * k), bv(k * n), wv(m * n), xv(k);
+  for (size_t i=0; i < av.size(); i++) av[i] = 0.1 * i - 0.7;
+  for (size_t i=0; i < bv.size(); i++) bv[i] = std::cos(1.0 * i);
+  for (size_t i=0; i < wv.size(); i++) wv[i] = 0.5 + 0.25 * i;
+  for (size_t i=0; i < xv.size(); i++) xv[i] = 1.0 - 0.3 * i;
+
+  // L = sum(W .* (A B)): dA = W B^T, dB = A^T W.
+  Matrix a(av, m, k), b(bv, k, n), w(wv, m, n);
+  Matrix c = matmul(a, b);
+  for (size_t i=0; i < m; i++) {
+    for (size_t j=0; j < n; j++) {
+      double expect = 0.0;
+      for (size_t p=0; p < k; p++) expect += av[i * k + p] * bv[p * n + j];
+      EXPECT_NEAR(c.get(i, j), expect, 1e-12);
+    }
+  }
+  (c * w).backward();
+  std::vector<double> ga = a.grad(), gb = b.grad();
+  for (size_t i=0; i < m; i++) {
+    for (size_t p=0; p < k; p++) {
+      double expect = 0.0;
+      for (size_t j=0; j < n; j++) expect += wv[i * n + j] * bv[p * n + j];
+      EXPECT_NEAR(ga[i * k + p], expect, 1e-12);
+    }
+  }
+  for (size_t p=0; p < k; p++) {
+    for (size_t j=0; j < n; j++) {
+      double expect = 0.0;
+      for (size_t i=0; i < m; i++) expect += av[i * k + p] * wv[i * n + j];
+      EXPECT_NEAR(gb[p * n + j], expect, 1e-12);
+    }
+  }
+
+  // The same product through transposed views: (B^T A^T)^T = A B.
+  Matrix at(av, m, k), bt(bv, k, n);
+  Matrix ct = matmul(bt.t(), at.t()).t();
+  EXPECT_TRUE(ct.transposed());
+  (ct * w).backward();
+  std::vector<double> cv = c.values(), ctv = ct.values(), gat = at.grad(), gbt = bt.grad();
+  for (size_t i=0; i < cv.size(); i++) EXPECT_NEAR(ctv[i], cv[i], 1e-12);
+  for (size_t i=0; i < ga.size(); i++) EXPECT_NEAR(gat[i], ga[i], 1e-12);
+  for (size_t i=0; i < gb.size(); i++) EXPECT_NEAR(gbt[i], gb[i], 1e-12);
+
+  // y = A x: dx = A^T 1.
+  Matrix a2(av, m, k);
+  Tensor x(xv);
+  Tensor y = matvec(a2, x);
+  y.backward();
+  std::vector<double> gx = x.grad();
+  for (size_t p=0; p < k; p++) {
+    double expect = 0.0;
+    for (size_t i=0; i < m; i++) expect += av[i * k + p];
+    EXPECT_NEAR(gx[p], expect, 1e-12);
+  }
+  EXPECT_NEAR(y.getitem(0), av[0] * xv[0] + av[1] * xv[1] + av[2] * xv[2] + av[3] * xv[3], 1e-12);
+}
+
+TEST(AutoDiffTest, VectorMathTest) {
+  // Distance in representable doubles; NaNs match each other.
+  auto ulp = [](double a, double b) -> uint64_t {
+    if (std::isnan(a) && std::isnan(b)) return 0;
+    if (a == b) return 0;
+    int64_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(a));
+    std::memcpy(&ib, &b, sizeof(b));
+    if (ia < 0) ia = std::numeric_limits<int64_t>::min() - ia;
+    if (ib < 0) ib = std::numeric_limits<int64_t>::min() - ib;
+    return ia > ib ? uint64_t(ia) - uint64_t(ib) : uint64_t(ib) - uint64_t(ia);
+  };
+  uint64_t state = 1;
+  auto next = [&]() {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state;
+  };
+  auto uniform = [&](double lo, double hi) {
+    std::vector<double> x(1 << 16);
+    for (double &v : x) v = lo + (hi - lo) * double(next() >> 11) / 9007199254740992.0;
+    return x;
+  };
+  auto positive = [&]() {
+    std::vector<double> x(1 << 16);
+    for (double &v : x) {
+      uint64_t bits = next() & 0x7fffffffffffffffull;
+      std::memcpy(&v, &bits, sizeof(v));
+    }
+    return x;
+  };
+  const double inf = std::numeric_limits<double>::infinity(), nan = std::numeric_limits<double>::quiet_NaN();
+  const std::vector<double> special = { 0.0, -0.0, inf, -inf, nan, 1e-310, -1.0, 709.78, 709.79, -745.1, -745.2,
+                                        1e300, -1e300, 1e22, vmath::sincos_limit, -2 * vmath::sincos_limit };
+
+  typedef void (*Kernel)(size_t, const double *, double *);
+  typedef double (*Reference)(double);
+  auto check = [&](Kernel f, Reference g, std::vector<double> x, uint64_t bound) {
+    // Odd length, so every build runs its tail too.
+    x.insert(x.end(), special.begin(), special.end());
+    x.push_back(0.5);
+    std::vector<double> y(x.size());
+    f(x.size(), x.data(), y.data());
+    uint64_t worst = 0;
+    for (size_t i=0; i < x.size(); i++) worst = std::max(worst, ulp(y[i], g(x[i])));
+    EXPECT_LE(worst, bound);
+  };
+  auto sin = [](double x) { return std::sin(x); };
+  auto cos = [](double x) { return std::cos(x); };
+
+  const vmath::Isa saved = vmath::isa();
+  for (int level=0; level <= static_cast<int>(vmath::detect()); level++) {
+    vmath::isa() = static_cast<vmath::Isa>(level);
+    check(vmath::exp, [](double x) { return std::exp(x); }, uniform(-746.0, 710.0), 1);
+    check(vmath::exp, [](double x) { return std::exp(x); }, uniform(-1.0, 1.0), 1);
+    check(vmath::log, [](double x) { return std::log(x); }, positive(), 1);
+    check(vmath::log, [](double x) { return std::log(x); }, uniform(0.5, 2.0), 1);
+    check(vmath::sin, sin, uniform(-10.0, 10.0), 1);
+    check(vmath::cos, cos, uniform(-10.0, 10.0), 1);
+    check(vmath::sin, sin, uniform(-2e6, 2e6), 2);
+    check(vmath::cos, cos, uniform(-2e6, 2e6), 2);
+    check(vmath::sqrt, [](double x) { return std::sqrt(x); }, positive(), 0);
+
+    std::vector<double> x = uniform(-3.0, 3.0), s(x.size()), c(x.size());
+    vmath::sincos(x.size(), x.data(), s.data(), c.data());
+    for (size_t i=0; i < x.size(); i++) {
+      EXPECT_LE(ulp(s[i], std::sin(x[i])), 1u);
+      EXPECT_LE(ulp(c[i], std::cos(x[i])), 1u);
+    }
+    // In place.
+    std::vector<double> y = x;
+    vmath::exp(y.size(), y.data(), y.data());
+    for (size_t i=0; i < x.size(); i++) EXPECT_LE(ulp(y[i], std::exp(x[i])), 1u);
+  }
+  vmath::isa() = saved;
+
+  // Vector ops and their in-place forms take values and partials from the
+  // kernels.
+  std::vector<double> xv = uniform(0.1, 3.0);
+  xv.resize(1001);
+  Vector v(xv.data(), xv.size()), w(xv.data(), xv.size());
+  Vector y = v.sin() + v.cos() + v.exp() + v.log() + v.sqrt();
+  w.sin_();
+  y.backward();
+  std::vector<double> grad = v.grad();
+  for (size_t i=0; i < xv.size(); i++) {
+    double x = xv[i];
+    EXPECT_NEAR(y.getitem(i), std::sin(x) + std::cos(x) + std::exp(x) + std::log(x) + std::sqrt(x), 1e-12);
+    EXPECT_NEAR(grad[i], std::cos(x) - std::sin(x) + std::exp(x) + 1.0 / x + 0.5 / std::sqrt(x), 1e-12);
+    EXPECT_NEAR(w.getitem(i), std::sin(x), 1e-15);
+  }
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -1,4 +1,5 @@
 import autodiff
+import numpy as np
 from pytest import approx
 
 class TestAutoDiff:
@@ -9,7 +10,7 @@ class TestAutoDiff:
 
         assert len(a) == 5
         assert isinstance(a, autodiff.vec)
-        assert a.values() == [10, 15, 3, 4, 5]
+        assert a.values().tolist() == [10, 15, 3, 4, 5]
         assert a[1] == 15
     
     def test_base_2(self):
@@ -19,7 +20,7 @@ class TestAutoDiff:
         
         assert len(a) == 3
         assert isinstance(a, autodiff.vec)
-        assert a.values() == [20, 21, 22]
+        assert a.values().tolist() == [20, 21, 22]
         assert a[1] == 21
 
     def test_grad_1(self):
@@ -64,3 +65,260 @@ class TestAutoDiff:
         for grad, gold in zip(b.grad(), (a.log() * b.exp()).values()):
             assert grad - gold == approx(0)
 
+    def test_numpy_1(self):
+        x = np.linspace(0.5, 2.0, 7)
+        a = autodiff.vec(x)
+        Q = a * a
+        Q.backward()
+
+        assert isinstance(a.values(), np.ndarray)
+        np.testing.assert_allclose(a.values(), x)
+        np.testing.assert_allclose(Q.values(), x * x)
+        np.testing.assert_allclose(a.grad(), 2 * x)
+
+    def test_tensor_1(self):
+        x = np.linspace(0.5, 2.0, 7)
+        a = autodiff.tensor(x)
+        b = autodiff.tensor(x[::-1])
+        Q = (a * b + a.sin()).exp().log()
+        Q.backward()
+
+        np.testing.assert_allclose(Q.values(), x * x[::-1] + np.sin(x))
+        np.testing.assert_allclose(a.grad(), x[::-1] + np.cos(x))
+        np.testing.assert_allclose(b.grad(), x)
+
+        # values and grad view the tensor's own storage
+        view = a.values()
+        view[0] = 10
+        assert a[0] == 10
+        before = a.grad().copy()
+        grad = a.grad()
+        a.backward()
+        np.testing.assert_allclose(grad, before + 1)
+        np.testing.assert_allclose(np.asarray(a), a.values())
+
+    def test_backward_many_1(self):
+        x = np.linspace(0.5, 2.0, 5)
+        a = autodiff.vec(x)
+        b = autodiff.vec(x)
+        P = a * b
+        Q = a.exp()
+        autodiff.backward_many([P, Q])
+
+        np.testing.assert_allclose(a.grad(), x + np.exp(x))
+        np.testing.assert_allclose(b.grad(), x)
+
+    def test_stats_1(self):
+        autodiff.reset_stats()
+        a = autodiff.vec(np.array([1.0, 2.0]))
+        Q = a.sin() * a
+        Q.backward()
+
+        s = autodiff.stats()
+        if s['enabled']:
+            assert s['nodes']['sin'] == 2
+            assert s['nodes']['mul'] == 2
+            assert s['recorded'] > 0 and s['bytes'] > 0
+        else:
+            assert s['recorded'] == 0 and s['bytes'] == 0
+        assert set(s['seconds']) == {'construct', 'record', 'sweep', 'accumulate'}
+
+    def test_compile_1(self):
+        x = np.array([0.5, 1.0, 1.5])
+        a = autodiff.vec(x)
+        b = autodiff.vec(x)
+        Q = a.sin() + b.cos() + a * 5 - (b + 2)
+        f = autodiff.compile([a, b], Q)
+
+        u = np.array([0.1, -0.2, 0.3])
+        v = np.array([2.0, 1.0, -1.0])
+        np.testing.assert_allclose(f.forward([u, v]), np.sin(u) + np.cos(v) + u * 5 - (v + 2))
+        grad = f.backward(np.ones(3))
+        np.testing.assert_allclose(grad[:3], np.cos(u) + 5)
+        np.testing.assert_allclose(grad[3:], -np.sin(v) - 1)
+
+    def test_jacobian_1(self):
+        x = np.array([0.5, 1.5])
+        a = autodiff.vec(x)
+        Q = a.sin() * 2
+        jac = autodiff.jacobian(Q, a)
+        np.testing.assert_allclose(jac, np.diag(2 * np.cos(x)))
+
+        Q.backward(np.array([1.0, -1.0]))
+        np.testing.assert_allclose(a.grad(), [2 * np.cos(x[0]), -2 * np.cos(x[1])])
+
+    def test_retain_1(self):
+        x = np.array([0.5, 1.0])
+        a = autodiff.vec(x)
+        Q = a.exp() * a
+        Q.retain()
+        for step in range(3):
+            x = x + 0.25
+            a.set_values(x)
+            Q.forward()
+            a.zero_grad()
+            Q.backward()
+            np.testing.assert_allclose(Q.values(), np.exp(x) * x)
+            np.testing.assert_allclose(a.grad(), np.exp(x) * (x + 1))
+
+    def test_hessian_1(self):
+        x = np.array([0.5, 2.0])
+        a = autodiff.vec(x)
+        Q = a.sin() * a
+        H = autodiff.hessian(Q, a)
+        d2 = 2 * np.cos(x) - x * np.sin(x)
+        np.testing.assert_allclose(H, np.diag(d2))
+        np.testing.assert_allclose(autodiff.hvp(Q, a, np.array([1.0, -2.0])), d2 * [1.0, -2.0])
+
+    def test_sparse_jacobian_1(self):
+        x = np.linspace(0.5, 2.0, 6)
+        a = autodiff.vec(x)
+        b = autodiff.vec(x + 1.0)
+        Q = a.sin() * b
+        J = autodiff.sparse_jacobian(Q, a)
+        assert J.shape == (6, 6)
+        assert J.nnz == 6
+        np.testing.assert_array_equal(J.indices, np.arange(6))
+        np.testing.assert_array_equal(J.indptr, np.arange(7))
+        np.testing.assert_allclose(J.data, np.cos(x) * (x + 1.0))
+        np.testing.assert_allclose(J.todense(), autodiff.jacobian(Q, a))
+
+    def test_checkpoint_1(self):
+        x = np.array([0.3, -0.8, 1.2])
+        step = lambda v: v.sin() * 0.9 + v * 0.1
+
+        a = autodiff.vec(x)
+        y = a
+        for _ in range(20):
+            y = step(y)
+        y.backward()
+
+        b = autodiff.vec(x)
+        z = autodiff.checkpoint_steps(step, b, 20, budget=6)
+        z.backward()
+        np.testing.assert_allclose(z.values(), y.values())
+        np.testing.assert_allclose(b.grad(), a.grad())
+
+        c = autodiff.vec(x)
+        Q = autodiff.checkpoint(lambda v: v.exp() * v, c)
+        Q.backward()
+        np.testing.assert_allclose(c.grad(), np.exp(x) * (1 + x))
+
+    def test_inplace_1(self):
+        x = np.array([0.5, 1.0, 1.5])
+        a = autodiff.vec(x)
+        Q = a * 2.0
+        ref = Q
+        Q += a
+        Q *= a
+        Q -= 1.0
+        Q /= a
+        assert Q is ref
+        assert Q.exp_() is Q
+        Q.backward()
+        np.testing.assert_allclose(Q.values(), np.exp(3 * x - 1 / x))
+        np.testing.assert_allclose(a.grad(), np.exp(3 * x - 1 / x) * (3 + 1 / x ** 2))
+
+    def test_reduction_1(self):
+        x = np.linspace(-1.0, 2.0, 300)
+        y = np.cos(x)
+        a = autodiff.vec(x)
+        b = autodiff.vec(y)
+        np.testing.assert_allclose(a.sum().values(), [x.sum()])
+        np.testing.assert_allclose(a.mean().values(), [x.mean()])
+        np.testing.assert_allclose(a.norm2().values(), [np.linalg.norm(x)])
+        Q = a.dot(b)
+        np.testing.assert_allclose(Q.values(), [x @ y])
+        Q.backward()
+        np.testing.assert_allclose(a.grad(), y)
+        np.testing.assert_allclose(b.grad(), x)
+
+    def test_matrix_1(self):
+        A = np.arange(12.0).reshape(3, 4) / 10
+        B = np.cos(np.arange(8.0)).reshape(4, 2)
+        W = np.array([[1.0, 2.0], [0.5, -1.0], [3.0, 0.25]])
+        a = autodiff.mat(A)
+        b = autodiff.mat(B)
+        C = (a @ b) * autodiff.mat(W)
+        assert C.shape == (3, 2)
+        np.testing.assert_allclose(C.values(), (A @ B) * W)
+        C.backward()
+        np.testing.assert_allclose(a.grad(), W @ B.T)
+        np.testing.assert_allclose(b.grad(), A.T @ W)
+        np.testing.assert_allclose(a.T.values(), A.T)
+
+        x = np.array([1.0, -1.0, 2.0, 0.5])
+        t = autodiff.tensor(x)
+        y = autodiff.mat(A) @ t
+        np.testing.assert_allclose(y.values(), A @ x)
+        y.backward()
+        np.testing.assert_allclose(t.grad(), A.sum(axis=0))
+
+    def test_threads_1(self):
+        import os
+        import threading
+        x = np.linspace(0.5, 1.5, 20000)
+        errors = []
+
+        def work():
+            try:
+                for _ in range(5):
+                    a = autodiff.vec(x)
+                    o = (a * a).sin()
+                    o.backward()
+                    np.testing.assert_allclose(a.grad(), 2 * x * np.cos(x * x))
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=work) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for n in (2, 3, 1):
+            autodiff.set_num_threads(n)
+        for t in threads:
+            t.join()
+        assert not errors
+        assert autodiff.num_threads() == 1
+        autodiff.set_num_threads(os.cpu_count())
+
+    def test_flat_dtype_1(self):
+        x = np.array([0.5, 1.0, 1.5])
+        y = np.array([2.0, 0.25, 3.0])
+        results = {}
+        for dtype in (np.float64, np.float32, "mixed"):
+            g = autodiff.graph(dtype=dtype)
+            a = g.vec(x)
+            b = g.vec(y)
+            o = (a.sin() * b + 2.0).exp() / (b - a.cos())
+            o.backward()
+            results[dtype] = (o.values(), a.grad(), b.grad())
+        assert results[np.float32][0].dtype == np.float32
+        assert results["mixed"][1].dtype == np.float64
+        for dtype in (np.float32, "mixed"):
+            for got, want in zip(results[dtype], results[np.float64]):
+                np.testing.assert_allclose(got, want, rtol=1e-5)
+
+    def test_vec_dtype_1(self):
+        x = np.array([0.5, 1.0, 1.5])
+        np.testing.assert_array_equal(autodiff.vec(x, dtype=np.float64).values(), x)
+        for dtype in (np.float32, "mixed"):
+            try:
+                autodiff.vec(x, dtype=dtype)
+                assert False
+            except TypeError:
+                pass
+
+    def test_flat_retain_1(self):
+        x = np.array([0.5, 1.0, 1.5])
+        g = autodiff.graph(dtype=np.float64)
+        p = g.vec(x)
+        loss = (p * p).sin() + p
+        loss.retain()
+        for _ in range(3):
+            x = x - 0.1
+            p.set_values(x)
+            loss.forward()
+            p.zero_grad()
+            loss.backward(np.full(3, 2.0))
+        np.testing.assert_allclose(loss.values(), np.sin(x * x) + x)
+        np.testing.assert_allclose(p.grad(), 2 * (2 * x * np.cos(x * x) + 1))